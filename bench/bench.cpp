@@ -0,0 +1,67 @@
+//
+// Micro-benchmarks for the formatter and the thread ring buffer, kept out of the demo in main.cpp.
+//
+
+#include "hilog.h"
+
+static xhong::Logger::ptr logger = HILOG_ROOT();
+
+// micro-benchmark: format one event with the default pattern.
+void benchFormatter(const char* name, xhong::LogFormatter& formatter) {
+    HILOG_DEFINE_CALLSITE(callSite, xhong::LogLevel::DEBUG, nullptr);
+    xhong::FmtLogEvent event(&*logger, &callSite, &xhong::GetThreadContext(), 0,
+                             xhong::TscClock::Now());
+    event.modernFormat("abc {};", 15.123);
+
+    const int          count = 1000000;
+    fmt::memory_buffer out;
+    size_t             total = 0;
+    auto               start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < count; i++) {
+        out.clear();
+        formatter.format(out, xhong::LogLevel::DEBUG, event);
+        total += out.size();
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    fmt::print("{}: {:.1f} ns/op ({} bytes)\n", name,
+               std::chrono::duration<double, std::nano>(stop - start).count() / count,
+               total / count);
+}
+
+// micro-benchmark: one producer thread streams fixed-size records through the ring.
+void benchBlockingBuffer(uint32_t capacity) {
+    const uint32_t              recordSize = 128;
+    const uint64_t              total      = 256ull << 20;
+    xhong::CircleBlockingBuffer buffer(capacity);
+    std::vector<char>           out(capacity);
+
+    auto        start = std::chrono::high_resolution_clock::now();
+    std::thread producer([&] {
+        char record[recordSize] = {};
+        for (uint64_t sent = 0; sent < total; sent += recordSize) {
+            buffer.produce(record, recordSize);
+        }
+    });
+    for (uint64_t received = 0; received < total;) {
+        uint32_t used = buffer.getUsedSize();
+        if (used == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        received += buffer.consume(out.data(), used);
+    }
+    producer.join();
+    auto stop = std::chrono::high_resolution_clock::now();
+    fmt::print("ring {} bytes: {:.0f} MB/s\n", capacity,
+               total / std::chrono::duration<double, std::micro>(stop - start).count());
+}
+
+int main() {
+    xhong::LogFormatter                                 formatter(xhong::DefaultLogPattern::value());
+    xhong::StaticLogFormatter<xhong::DefaultLogPattern> staticFormatter;
+    benchFormatter("formatter", formatter);
+    benchFormatter("static formatter", staticFormatter);
+    benchBlockingBuffer(1 << 16);
+    benchBlockingBuffer(1 << 25);
+    return 0;
+}
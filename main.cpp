@@ -34,7 +34,7 @@ int                       main() {
 
     fmt::print("time:{}", time_span);
 
-    Sleep(5000);
+    std::this_thread::sleep_for(std::chrono::seconds(5));
 
     return 0;
 }
\ No newline at end of file
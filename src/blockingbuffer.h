@@ -5,118 +5,825 @@
 #ifndef XHONGWHEELS_BLOCKINGBUFFER_H
 #define XHONGWHEELS_BLOCKINGBUFFER_H
 
+#include "log_record.h"
+#include <algorithm>
 #include <atomic>
-#include <math.h>
-#include <memory>
+#include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
 
 namespace xhong {
 
+/**
+ * @brief 缓存行大小
+ */
+static constexpr size_t kCacheLineSize = 64;
+
+/**
+ * @brief 线程缓冲区写满时的处理策略
+ */
+struct BackpressurePolicy {
+    enum Mode : uint8_t {
+        // 等待后台线程腾出空间: 先自旋, 再让出CPU, 最后挂起在futex上
+        BLOCK = 0,
+        // 丢弃新记录
+        DROP_NEWEST = 1,
+        // 丢弃缓冲区中最旧的记录
+        OVERWRITE_OLDEST = 2,
+        // 低于level的记录丢弃, 其余记录等待
+        DROP_BELOW_LEVEL = 3
+    };
+
+    Mode            mode  = BLOCK;           /// 处理策略
+    LogLevel::Level level = LogLevel::WARN;  /// DROP_BELOW_LEVEL的级别阈值
+};
+
+/**
+ * @brief 单生产者单消费者的环形缓冲区, 存放LogRecordHeader开头的日志记录
+ * @details 读写位置是单调递增的32位计数, 通过与(容量-1)取模映射到缓冲区,
+ *          因此容量必须是2的幂且不超过2^31, 已用长度即两者之差, 满与空不会混淆.
+ *          生产者状态与消费者状态位于不同的缓存行, 每一端都缓存对端的位置,
+ *          只有缓存值不足以完成本次操作时才重新读取.
+ *          消费者先用CAS推进m_head认领一段记录, 读取完成后再推进m_released归还空间;
+ *          生产者只根据m_released计算可写空间. OVERWRITE_OLDEST策略下生产者在
+ *          m_released == m_head(没有认领中的记录)时用CAS推进m_head丢弃最旧的记录,
+ *          与消费者的认领互斥, 因此丢弃的空间不会被正在读取的消费者读到
+ */
 class CircleBlockingBuffer {
   public:
     using ptr = std::shared_ptr<CircleBlockingBuffer>;
+
+    static constexpr uint32_t kSpinCount   = 64;    /// BLOCK策略自旋次数
+    static constexpr uint32_t kYieldCount  = 16;    /// BLOCK策略自旋后让出CPU的次数
+    static constexpr uint32_t kWaitTimeout = 1000;  /// BLOCK策略单次futex等待上限(微秒)
+
+    /**
+     * @brief 构造函数
+     * @param[in] blockingBufferSize 缓冲区容量, 必须是2的幂
+     */
     CircleBlockingBuffer(uint32_t blockingBufferSize) : m_blockingBufferSize(blockingBufferSize) {
         m_buffer = static_cast<char*>(malloc(m_blockingBufferSize));
     }
 
     ~CircleBlockingBuffer() { free(m_buffer); }
+
+    CircleBlockingBuffer(const CircleBlockingBuffer&) = delete;
+    CircleBlockingBuffer& operator=(const CircleBlockingBuffer&) = delete;
+
+    /**
+     * @brief 获取缓冲区容量
+     */
+    uint32_t getCapacity() const { return m_blockingBufferSize; }
+
     /**
-     * 将线性坐标映射成环形缓存中坐标
-     * @param pos
-     * @return
+     * @brief 将线性坐标映射成环形缓存中坐标
      */
     uint32_t getPosInCircle(uint32_t pos) const { return pos & (m_blockingBufferSize - 1); }
 
     /**
-     * 获取已经使用的长度
-     * @return
+     * @brief 获取可消费的长度, 只能由消费者调用
      */
-    uint32_t getUsedSize() const {
-        std::atomic_thread_fence(std::memory_order_acquire);
-        uint32_t size = 0;
-        if (m_producedPos >= m_consumedPos) {
-            size = m_producedPos - m_consumedPos;
+    uint32_t getUsedSize() {
+        m_consumer.cachedPos = m_producer.pos.load(std::memory_order_acquire);
+        return m_consumer.cachedPos - m_consumer.pos.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief 获取可写入的长度, 只能由生产者调用
+     */
+    uint32_t getUnusedSize() {
+        m_producer.cachedPos = m_released.load(std::memory_order_acquire);
+        return m_blockingBufferSize -
+               (m_producer.pos.load(std::memory_order_relaxed) - m_producer.cachedPos);
+    }
+
+    /**
+     * @brief 获取生产者已提交的位置
+     */
+    uint32_t getProducedPos() const { return m_producer.pos.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 获取消费者已归还的位置, 生产者丢弃最旧记录时也会推进它
+     */
+    uint32_t getReleasedPos() const { return m_released.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 生产者视角的已用长度, 只能由生产者调用
+     * @details 使用缓存的归还位置, 不读取消费者的缓存行, 结果可能偏大
+     */
+    uint32_t getFill() const {
+        return m_producer.pos.load(std::memory_order_relaxed) - m_producer.cachedPos;
+    }
+
+    /**
+     * @brief 获取生产者累计丢弃的记录数
+     */
+    uint64_t getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 累加丢弃的记录数, 只能由生产者调用
+     */
+    void addDropped(uint64_t count) {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + count,
+                        std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 重置, 调用时不能有并发的生产者或消费者
+     */
+    void reset() {
+        m_producer.pos.store(0, std::memory_order_relaxed);
+        m_producer.cachedPos = 0;
+        m_consumer.pos.store(0, std::memory_order_relaxed);
+        m_consumer.cachedPos = 0;
+        m_released.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 原地认领到上次getUsedSize()看到的生产位置为止的记录, 最多size字节,
+     *        只能由消费者调用
+     * @param[in] size 最多认领的字节数
+     * @param[out] spans 认领的记录在缓冲区中的位置, 跨过缓冲区末尾时分成两段, 第二段可能为空
+     * @details 生产位置总在记录边界上, 记录也不会跨过缓冲区末尾, 因此size取自getUsedSize()时
+     *          两段都只包含完整的记录; 生产者丢弃最旧记录后实际认领的字节数可能更少.
+     *          认领的空间在release()之前不会被生产者复用或丢弃
+     * @return 实际认领的字节数, 非0时读取完毕后必须调用release()
+     */
+    uint32_t claim(uint32_t size, LogSpan spans[2]) {
+        uint32_t head = m_consumer.pos.load(std::memory_order_acquire);
+        uint32_t availSize;
+        do {
+            // 生产者可能已经丢弃到缓存的生产位置之后.
+            if (static_cast<int32_t>(m_consumer.cachedPos - head) <= 0) {
+                return 0;
+            }
+            availSize = std::min(m_consumer.cachedPos - head, size);
+        } while (!m_consumer.pos.compare_exchange_weak(head, head + availSize,
+                                                       std::memory_order_acq_rel));
+
+        // offset of consumePos to buffer end.
+        uint32_t offset  = getPosInCircle(head);
+        uint32_t off2End = std::min(availSize, m_blockingBufferSize - offset);
+        spans[0]         = LogSpan{m_buffer + offset, off2End, LogLevel::UNKNOW};
+        spans[1]         = LogSpan{m_buffer, availSize - off2End, LogLevel::UNKNOW};
+        m_claimEnd       = head + availSize;
+        return availSize;
+    }
+
+    /**
+     * @brief 归还最近一次claim()认领的空间, 只能由消费者在claim()返回非0后调用一次
+     */
+    void release() {
+        // 与生产者的m_waiting构成Dekker式同步, 两边都使用seq_cst.
+        m_released.store(m_claimEnd, std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_seq_cst)) {
+            FutexWake(&m_released, 1);
         }
-        else {
-            size = m_blockingBufferSize + m_producedPos - m_consumedPos;
+    }
+
+    /**
+     * @brief 消费到上次getUsedSize()看到的生产位置为止, 最多size字节, 只能由消费者调用
+     * @details 认领后拷贝到toBuf并立即归还, 参见claim()
+     * @return 实际消费的字节数
+     */
+    uint32_t consume(char* toBuf, uint32_t size) {
+        LogSpan  spans[2];
+        uint32_t availSize = claim(size, spans);
+        if (availSize == 0) {
+            return 0;
         }
-        return size;
+        memcpy(toBuf, spans[0].data, spans[0].size);
+        memcpy(toBuf + spans[0].size, spans[1].data, spans[1].size);
+        release();
+        return availSize;
     }
 
     /**
-     * 获取未使用的长度
-     * @return
+     * @brief 单条记录的最大长度, 不超过该长度的记录一定能找到连续空间
      */
-    uint32_t getUnusedSize() const { return m_blockingBufferSize - getUsedSize(); }
+    uint32_t maxRecordSize() const { return m_blockingBufferSize / 2; }
 
     /**
-     * 重置
+     * @brief 在缓冲区中预留size字节的连续空间, 只能由生产者调用
+     * @details size不能超过maxRecordSize(). 写入位置之后到缓冲区末尾放不下时,
+     *          返回缓冲区起始地址, 末尾的剩余空间在commit时写入一条填充记录.
+     *          提交前可以用更大的size再次调用, 返回地址可能改变, 已写入的内容需要调用方搬移
+     * @param[in] size 预留字节数
+     * @param[in] policy 空间不足时的处理策略
+     * @param[in] level 记录的日志级别, 供DROP_BELOW_LEVEL使用
+     * @return 预留空间的起始地址, 按策略放弃写入时返回nullptr
      */
-    void reset() { m_consumedPos = m_producedPos = 0; }
+    char* reserve(uint32_t                  size,
+                  const BackpressurePolicy& policy = BackpressurePolicy(),
+                  LogLevel::Level           level  = LogLevel::UNKNOW) {
+        uint32_t pos    = m_producer.pos.load(std::memory_order_relaxed);
+        uint32_t offset = getPosInCircle(pos);
+        uint32_t tail   = m_blockingBufferSize - offset;
+        uint32_t need   = LogRecordHeader::Align(size);
+        m_padding       = 0;
+        if (need > tail) {
+            m_padding = tail;
+            need += tail;
+            offset = 0;
+        }
+        if (XHONG_UNLIKELY(m_blockingBufferSize - (pos - m_producer.cachedPos) < need) &&
+            getUnusedSize() < need && !waitForSpace(need, policy, level)) {
+            return nullptr;
+        }
+        return m_buffer + offset;
+    }
 
     /**
-     * 使用n个字节长度
-     * @param n
+     * @brief 提交最近一次reserve得到的空间中的前size字节, 对消费者可见
      */
-    void consume(uint32_t n) { m_consumedPos = getPosInCircle(m_consumedPos + n); }
+    void commit(uint32_t size) {
+        uint32_t pos = m_producer.pos.load(std::memory_order_relaxed);
+        if (m_padding > 0) {
+            LogRecordHeader padding{m_padding, LogRecordHeader::PADDING, 0};
+            memcpy(m_buffer + getPosInCircle(pos), &padding, sizeof(padding));
+        }
+        m_producer.pos.store(pos + m_padding + LogRecordHeader::Align(size),
+                             std::memory_order_release);
+    }
 
     /**
-     * 消费n字节长度
-     * @param to
-     * @param n
-     * @return
+     * @brief 写入一条size字节的记录, 空间不足时等待消费者
      */
-    uint32_t consume(char* toBuf, uint32_t size) {
-        // available bytes to consume.
-        uint32_t availSize = std::min(getUsedSize(), size);
+    void produce(const char* fromBuf, uint32_t size) {
+        memcpy(reserve(size), fromBuf, size);
+        commit(size);
+    }
 
-        // offset of consumePos to buffer end.
-        uint32_t off2End = std::min(availSize, m_blockingBufferSize - m_consumedPos);
+  private:
+    /**
+     * @brief 按策略处理空间不足
+     * @return 得到need字节的可写空间时返回true, 放弃写入时返回false
+     */
+    XHONG_COLD bool waitForSpace(uint32_t                  need,
+                                 const BackpressurePolicy& policy,
+                                 LogLevel::Level           level) {
+        switch (policy.mode) {
+            case BackpressurePolicy::DROP_NEWEST:
+                return false;
+            case BackpressurePolicy::DROP_BELOW_LEVEL:
+                if (level < policy.level) {
+                    return false;
+                }
+                break;
+            case BackpressurePolicy::OVERWRITE_OLDEST:
+                // 消费者正在读取认领的记录时不能丢弃, 等它归还.
+                while (!dropOldest(need)) {
+                    std::this_thread::yield();
+                }
+                return true;
+            default:
+                break;
+        }
+
+        uint32_t pos = m_producer.pos.load(std::memory_order_relaxed);
+        for (uint32_t spins = 0; getUnusedSize() < need; ++spins) {
+            if (spins < kSpinCount) {
+                CpuRelax();
+            }
+            else if (spins < kSpinCount + kYieldCount) {
+                std::this_thread::yield();
+            }
+            else {
+                m_waiting.store(1, std::memory_order_seq_cst);
+                uint32_t released = m_released.load(std::memory_order_seq_cst);
+                if (m_blockingBufferSize - (pos - released) < need) {
+                    FutexWait(&m_released, released, kWaitTimeout);
+                }
+                m_waiting.store(0, std::memory_order_relaxed);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief 丢弃最旧的记录直到腾出need字节, 只能由生产者调用
+     * @return 消费者正在读取认领的记录时返回false
+     */
+    bool dropOldest(uint32_t need) {
+        uint32_t head = m_consumer.pos.load(std::memory_order_acquire);
+        if (m_released.load(std::memory_order_acquire) != head) {
+            return false;
+        }
+
+        // 记录头部由生产者自己写入, 消费者只读不写, 可以安全读取.
+        uint32_t pos     = m_producer.pos.load(std::memory_order_relaxed);
+        uint32_t newHead = head;
+        uint64_t count   = 0;
+        while (m_blockingBufferSize - (pos - newHead) < need) {
+            LogRecordHeader header;
+            memcpy(&header, m_buffer + getPosInCircle(newHead), sizeof(header));
+            if (header.kind != LogRecordHeader::PADDING) {
+                ++count;
+            }
+            newHead += LogRecordHeader::Align(header.size);
+        }
+        if (!m_consumer.pos.compare_exchange_strong(head, newHead, std::memory_order_acq_rel)) {
+            return false;
+        }
+        // 失败说明消费者已经认领并归还了更靠后的位置.
+        m_released.compare_exchange_strong(head, newHead, std::memory_order_acq_rel);
+        m_producer.cachedPos = m_released.load(std::memory_order_acquire);
+        addDropped(count);
+        return true;
+    }
+
+    /**
+     * @brief 一端独占的读写状态
+     */
+    struct Cursor {
+        std::atomic<uint32_t> pos{0};        /// 本端位置
+        uint32_t              cachedPos{0};  /// 最近一次读到的对端位置
+    };
+
+    // 两端共享的只读状态.
+    uint32_t m_blockingBufferSize{2 * 1024 * 1024};
+    char*    m_buffer{nullptr};
+    char     m_pad0[kCacheLineSize];
+    // 生产者状态, m_producer.cachedPos缓存m_released.
+    Cursor                m_producer;
+    uint32_t              m_padding{0};  /// 最近一次reserve需要的末尾填充字节数
+    std::atomic<uint32_t> m_waiting{0};  /// 生产者是否挂起在m_released上
+    std::atomic<uint64_t> m_dropped{0};  /// 累计丢弃的记录数
+    char m_pad1[kCacheLineSize - sizeof(Cursor) - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+    // 消费者状态, m_consumer.pos即认领位置m_head, m_consumer.cachedPos缓存生产位置.
+    Cursor                m_consumer;
+    std::atomic<uint32_t> m_released{0};  /// 消费者读取完成并归还的位置
+    uint32_t              m_claimEnd{0};  /// 最近一次认领的结束位置
+    char                  m_pad2[kCacheLineSize - sizeof(Cursor) - 2 * sizeof(uint32_t)];
+};
+
+constexpr uint32_t CircleBlockingBuffer::kSpinCount;
+constexpr uint32_t CircleBlockingBuffer::kYieldCount;
+constexpr uint32_t CircleBlockingBuffer::kWaitTimeout;
+
+/**
+ * @brief 线程缓冲区的一个分段
+ */
+struct BufferSegment {
+    explicit BufferSegment(uint32_t size) : ring(size) {}
+
+    CircleBlockingBuffer        ring;           /// 分段内的环形缓冲区
+    std::atomic<BufferSegment*> next{nullptr};  /// 生产者切换到的下一个分段
+};
+
+/**
+ * @brief 全部日志器共享的缓冲区分段池
+ * @details 标准分段(kSegmentSize)回收后留在池中复用, 更大的分段只为超长记录分配, 回收时释放.
+ *          分配出去与池中缓存的分段总量不超过内存预算, 每个线程的首个分段不受预算限制
+ */
+class SegmentPool {
+  public:
+    static constexpr uint32_t kSegmentSize    = 64 * 1024;          /// 标准分段大小
+    static constexpr uint32_t kMaxSegmentSize = 8 * 1024 * 1024;    /// 最大分段大小
+    static constexpr uint64_t kDefaultBudget  = 256 * 1024 * 1024;  /// 默认内存预算
+
+    /**
+     * @brief 返回全局分段池
+     * @details 有意不释放, 避免与静态日志器及线程局部缓冲区的析构顺序问题
+     */
+    static SegmentPool& Instance() {
+        static SegmentPool* pool = new SegmentPool;
+        return *pool;
+    }
+
+    /**
+     * @brief 设置内存预算(字节), 已经分配的分段不受影响
+     */
+    void setBudget(uint64_t budget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        trimLocked();
+    }
+
+    /**
+     * @brief 获取内存预算(字节)
+     */
+    uint64_t getBudget() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget;
+    }
+
+    /**
+     * @brief 获取已分配的分段总字节数, 包括池中缓存的分段
+     */
+    uint64_t getAllocated() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_allocated;
+    }
+
+    /**
+     * @brief 获取一个能容纳size字节记录的分段
+     * @param[in] size 记录长度
+     * @param[in] force 为true时不检查预算
+     * @return 超出预算或记录过长时返回nullptr
+     */
+    BufferSegment* acquire(uint32_t size, bool force = false) {
+        uint32_t segmentSize = kSegmentSize;
+        while (segmentSize / 2 < size && segmentSize < kMaxSegmentSize) {
+            segmentSize *= 2;
+        }
+        if (segmentSize / 2 < size) {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (segmentSize == kSegmentSize && !m_free.empty()) {
+            BufferSegment* segment = m_free.back();
+            m_free.pop_back();
+            return segment;
+        }
+        if (!force && m_allocated + segmentSize > m_budget) {
+            return nullptr;
+        }
+        m_allocated += segmentSize;
+        return new BufferSegment(segmentSize);
+    }
 
-        if (off2End == availSize) {
-            memcpy(toBuf, m_buffer + m_consumedPos, availSize);
+    /**
+     * @brief 归还分段, 调用时不能再有线程访问该分段
+     */
+    void release(BufferSegment* segment) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (segment->ring.getCapacity() == kSegmentSize && m_allocated <= m_budget) {
+            segment->ring.reset();
+            segment->next.store(nullptr, std::memory_order_relaxed);
+            m_free.push_back(segment);
         }
         else {
-            // first put the data starting from consumePos until the end of buffer.
-            memcpy(toBuf, m_buffer + m_consumedPos, off2End);
-            // then put the rest at beginning of the buffer.
-            memcpy(toBuf + off2End, m_buffer, availSize - off2End);
+            m_allocated -= segment->ring.getCapacity();
+            delete segment;
         }
+    }
 
-        m_consumedPos = getPosInCircle(m_consumedPos + availSize);
-        std::atomic_thread_fence(std::memory_order_release);
+  private:
+    SegmentPool() = default;
 
-        return availSize;
+    /**
+     * @brief 预算调低后释放池中多余的分段, 调用方需持有m_mutex
+     */
+    void trimLocked() {
+        while (m_allocated > m_budget && !m_free.empty()) {
+            delete m_free.back();
+            m_free.pop_back();
+            m_allocated -= kSegmentSize;
+        }
     }
 
-    void produce(const char* fromBuf, uint32_t size) {
-        while (getUnusedSize() < size) {
-            /* blocking */;
+    std::mutex                  m_mutex;                       /// Mutex
+    uint64_t                    m_budget    = kDefaultBudget;  /// 内存预算
+    uint64_t                    m_allocated = 0;               /// 已分配的字节数
+    std::vector<BufferSegment*> m_free;                        /// 空闲的标准分段
+};
+
+constexpr uint32_t SegmentPool::kSegmentSize;
+constexpr uint32_t SegmentPool::kMaxSegmentSize;
+constexpr uint64_t SegmentPool::kDefaultBudget;
+
+/**
+ * @brief 分段的线程缓冲区, 单生产者单消费者
+ * @details 从一个标准分段开始, 当前分段放不下新记录时从分段池取一个新分段,
+ *          记录提交时才把新分段接到链尾, 生产者此后只写新分段;
+ *          消费者读空一个分段且其后已有分段时把它还给分段池.
+ *          预算耗尽时在最后一个分段上按背压策略处理
+ */
+class SegmentedBuffer {
+  public:
+    using ptr = std::shared_ptr<SegmentedBuffer>;
+
+    SegmentedBuffer() {
+        m_head = m_tail = SegmentPool::Instance().acquire(0, true);
+    }
+
+    ~SegmentedBuffer() {
+        releaseSpare();
+        if (m_pending != nullptr) {
+            SegmentPool::Instance().release(m_pending);
         }
+        while (m_head != nullptr) {
+            BufferSegment* next = m_head->next.load(std::memory_order_acquire);
+            SegmentPool::Instance().release(m_head);
+            m_head = next;
+        }
+    }
 
-        // offset of producePos to buffer end.
-        uint32_t off2End = std::min(size, m_blockingBufferSize - m_producedPos);
-        if (off2End == size) {
-            memcpy(m_buffer + m_producedPos, fromBuf, size);
+    SegmentedBuffer(const SegmentedBuffer&) = delete;
+    SegmentedBuffer& operator=(const SegmentedBuffer&) = delete;
+
+    /**
+     * @brief 缓冲区中的一个位置
+     */
+    struct Position {
+        uint64_t segment;  /// 分段序号, 首个分段为0
+        uint32_t pos;      /// 分段内环形缓冲区的位置
+    };
+
+    /**
+     * @brief 获取当前分段可消费的长度, 只能由消费者调用
+     * @details 当前分段读空且生产者已经切换到后续分段时, 回收当前分段
+     */
+    uint32_t getUsedSize() {
+        for (;;) {
+            // 先读next: 生产者切换分段前对旧分段的提交都已可见.
+            BufferSegment* next = m_head->next.load(std::memory_order_acquire);
+            uint32_t       used = m_head->ring.getUsedSize();
+            // 认领中的分段还在被读取, 归还前不能回收.
+            if (used > 0 || next == nullptr || m_claimed) {
+                return used;
+            }
+            SegmentPool::Instance().release(m_head);
+            m_head = next;
+            ++m_headIndex;
+        }
+    }
+
+    /**
+     * @brief 返回生产者已提交的位置, 只能由消费者调用
+     * @details 沿分段链走到已接入的最后一个分段, 此前提交的记录都在该位置之前
+     */
+    Position getProducedPosition() const {
+        BufferSegment* segment = m_head;
+        uint64_t       index   = m_headIndex;
+        for (BufferSegment* next; (next = segment->next.load(std::memory_order_acquire));) {
+            segment = next;
+            ++index;
+        }
+        return Position{index, segment->ring.getProducedPos()};
+    }
+
+    /**
+     * @brief 消费者是否已经归还了position之前的全部空间, 只能由消费者调用
+     * @details 生产者丢弃最旧记录越过的位置同样视为已归还
+     */
+    bool isReleasedPast(const Position& position) const {
+        if (m_headIndex != position.segment) {
+            return m_headIndex > position.segment;
+        }
+        return static_cast<int32_t>(m_head->ring.getReleasedPos() - position.pos) >= 0;
+    }
+
+    /**
+     * @brief 从当前分段消费, 参见CircleBlockingBuffer::consume
+     */
+    uint32_t consume(char* toBuf, uint32_t size) { return m_head->ring.consume(toBuf, size); }
+
+    /**
+     * @brief 原地认领当前分段中的记录, 参见CircleBlockingBuffer::claim
+     */
+    uint32_t claim(uint32_t size, LogSpan spans[2]) {
+        uint32_t claimed = m_head->ring.claim(size, spans);
+        m_claimed        = claimed != 0;
+        return claimed;
+    }
+
+    /**
+     * @brief 归还最近一次claim()认领的空间, 没有认领中的空间时什么也不做
+     */
+    void release() {
+        if (m_claimed) {
+            m_head->ring.release();
+            m_claimed = false;
+        }
+    }
+
+    /**
+     * @brief 获取累计丢弃的记录数
+     */
+    uint64_t getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief 累加丢弃的记录数, 只能由生产者调用
+     */
+    void addDropped(uint64_t count) {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + count,
+                        std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 生产者视角的链尾分段已用长度, 参见CircleBlockingBuffer::getFill
+     */
+    uint32_t getFill() const { return m_tail->ring.getFill(); }
+
+    /**
+     * @brief 标记生产者线程已经退出, 之后不会再有新记录
+     */
+    void retire() { m_retired.store(true, std::memory_order_release); }
+
+    /**
+     * @brief 生产者线程是否已经退出
+     * @details 返回true后再调用getUsedSize()得到0, 说明缓冲区已经读空, 可以回收
+     */
+    bool isRetired() const { return m_retired.load(std::memory_order_acquire); }
+
+    /**
+     * @brief 单条记录的最大长度
+     */
+    uint32_t maxRecordSize() const { return SegmentPool::kMaxSegmentSize / 2; }
+
+    /**
+     * @brief 预留size字节的连续空间, 参见CircleBlockingBuffer::reserve
+     * @details 当前分段空间不足时先尝试切换到新分段, 返回地址可能位于新分段
+     */
+    char* reserve(uint32_t                  size,
+                  const BackpressurePolicy& policy = BackpressurePolicy(),
+                  LogLevel::Level           level  = LogLevel::UNKNOW) {
+        static const BackpressurePolicy kTry{BackpressurePolicy::DROP_NEWEST, LogLevel::UNKNOW};
+
+        CircleBlockingBuffer& ring = (m_pending != nullptr ? m_pending : m_tail)->ring;
+        if (size <= ring.maxRecordSize()) {
+            if (char* p = ring.reserve(size, kTry, level)) {
+                return p;
+            }
+        }
+        return reserveSlow(size, policy, level);
+    }
+
+    /**
+     * @brief 提交最近一次reserve得到的空间中的前size字节
+     */
+    void commit(uint32_t size) {
+        if (XHONG_LIKELY(m_pending == nullptr)) {
+            m_tail->ring.commit(size);
+            return;
+        }
+        // 先提交记录再接入链表, 消费者看到新分段时旧分段的内容都已可见.
+        m_pending->ring.commit(size);
+        m_tail->next.store(m_pending, std::memory_order_release);
+        m_tail    = m_pending;
+        m_pending = nullptr;
+        releaseSpare();
+    }
+
+    /**
+     * @brief 写入一条size字节的记录
+     * @return 按策略丢弃时返回false
+     */
+    bool produce(const char* fromBuf, uint32_t size) {
+        char* p = reserve(size);
+        if (p == nullptr) {
+            addDropped(1);
+            return false;
+        }
+        memcpy(p, fromBuf, size);
+        commit(size);
+        return true;
+    }
+
+  private:
+    /**
+     * @brief 当前分段放不下时取新分段, 预算耗尽时在链尾分段上按策略处理
+     * @details 新分段提交前不接入链表. 被替换的待接入分段可能还存放着调用方
+     *          尚未搬移的内容, 暂存到m_spare, 提交后再归还
+     */
+    XHONG_COLD char* reserveSlow(uint32_t                  size,
+                                 const BackpressurePolicy& policy,
+                                 LogLevel::Level           level) {
+        releaseSpare();
+        m_spare   = m_pending;
+        m_pending = SegmentPool::Instance().acquire(size);
+        if (m_pending != nullptr) {
+            return m_pending->ring.reserve(size);
+        }
+
+        CircleBlockingBuffer& ring = m_tail->ring;
+        if (size > ring.maxRecordSize()) {
+            return nullptr;
+        }
+        uint64_t dropped = ring.getDropped();
+        char*    p       = ring.reserve(size, policy, level);
+        addDropped(ring.getDropped() - dropped);
+        return p;
+    }
+
+    /**
+     * @brief 归还暂存的分段
+     */
+    void releaseSpare() {
+        if (m_spare != nullptr) {
+            SegmentPool::Instance().release(m_spare);
+            m_spare = nullptr;
+        }
+    }
+
+    // 生产者状态.
+    BufferSegment* m_tail;             /// 链尾分段
+    BufferSegment* m_pending{nullptr};  /// 已取得但尚未接入链表的分段
+    BufferSegment* m_spare{nullptr};    /// 等待归还的待接入分段
+    char           m_pad0[kCacheLineSize];
+    // 消费者状态.
+    BufferSegment*        m_head;            /// 消费者读取的分段
+    uint64_t              m_headIndex{0};    /// m_head的分段序号
+    bool                  m_claimed{false};  /// m_head中是否有认领中的空间
+    std::atomic<uint64_t> m_dropped{0};      /// 累计丢弃的记录数
+    std::atomic<bool>     m_retired{false};  /// 生产者线程是否已经退出
+};
+
+/**
+ * @brief 直接建立在环形缓冲区预留空间上的记录缓冲区
+ * @details 构造时预留记录头部, 格式器把日志文本直接追加到环形缓冲区中, 提交时补写头部.
+ *          超过maxRecordSize()或按策略放弃预留的记录转存到溢出缓冲区,
+ *          提交时截断后拷贝进环形缓冲区
+ */
+class RingRecordBuffer : public fmt::detail::buffer<char> {
+  public:
+    static constexpr uint32_t kInitialReserve = 512;  /// 首次预留的字节数
+
+    /**
+     * @brief 构造函数
+     * @param[in] ring 当前线程的缓冲区
+     * @param[in] logger 记录所属的日志器
+     * @param[in] level 日志级别
+     * @param[in] time 记录产生时的时钟原始读数
+     * @param[in] policy 缓冲区写满时的处理策略
+     * @details 按策略放弃预留时先格式化到溢出缓冲区, 提交时再尝试一次
+     */
+    RingRecordBuffer(SegmentedBuffer&          ring,
+                     Logger*                   logger,
+                     LogLevel::Level           level,
+                     uint64_t                  time,
+                     const BackpressurePolicy& policy = BackpressurePolicy())
+        : m_ring(ring), m_logger(logger), m_level(level), m_time(time), m_policy(policy) {
+        uint32_t capacity = std::min(kInitialReserve, ring.maxRecordSize());
+        if (char* p = ring.reserve(capacity, m_policy, m_level)) {
+            set(p, capacity);
         }
         else {
-            // first put the data starting from producePos until the end of buffer.
-            memcpy(m_buffer + m_producedPos, fromBuf, off2End);
+            m_overflowed = true;
+            set(m_overflow.data(), m_overflow.capacity());
+        }
+        try_resize(sizeof(TimedRecordHeader));
+    }
+
+    /**
+     * @brief 写入记录头部并提交, 之后不能再使用该缓冲区
+     * @param[in] kind 记录类型
+     * @return 按策略丢弃时返回false, 丢弃计入缓冲区的丢弃计数
+     */
+    bool commit(LogRecordHeader::Kind kind) {
+        uint32_t size = static_cast<uint32_t>(
+            std::min<size_t>(this->size(), m_ring.maxRecordSize()));
+        char* p = data();
+        if (m_overflowed) {
+            p = m_ring.reserve(size, m_policy, m_level);
+            if (p == nullptr) {
+                m_ring.addDropped(1);
+                return false;
+            }
+            memcpy(p, data(), size);
+        }
+        TimedRecordHeader header{{size, kind, static_cast<uint16_t>(m_level)}, m_time, m_logger};
+        memcpy(p, &header, sizeof(header));
+        m_ring.commit(size);
+        return true;
+    }
 
-            // then put the rest at beginning of the buffer.
-            memcpy(m_buffer, fromBuf + off2End, size - off2End);
+  protected:
+    void grow(size_t capacity) override {
+        size_t maxSize = m_ring.maxRecordSize();
+        if (!m_overflowed && capacity <= maxSize) {
+            uint32_t newCapacity = static_cast<uint32_t>(
+                std::min(std::max(capacity, this->capacity() * 2), maxSize));
+            char* old = data();
+            char* p   = m_ring.reserve(newCapacity, m_policy, m_level);
+            if (p != nullptr) {
+                // 末尾空间不足时预留区移到缓冲区开头, 两段区域不会重叠.
+                if (p != old) {
+                    memcpy(p, old, size());
+                }
+                set(p, newCapacity);
+                return;
+            }
         }
 
-        m_producedPos = getPosInCircle(m_producedPos + size);
-        std::atomic_thread_fence(std::memory_order_release);
+        if (!m_overflowed) {
+            m_overflow.reserve(capacity);
+            memcpy(m_overflow.data(), data(), size());
+            m_overflowed = true;
+        }
+        m_overflow.resize(size());
+        m_overflow.reserve(capacity);
+        set(m_overflow.data(), m_overflow.capacity());
     }
 
   private:
-    uint32_t m_blockingBufferSize{2 * 1024 * 1024};
-    uint32_t m_producedPos{0};
-    uint32_t m_consumedPos{0};
-    char*    m_buffer{nullptr};
+    SegmentedBuffer&   m_ring;                /// 所属线程缓冲区
+    Logger*            m_logger;              /// 记录所属的日志器
+    LogLevel::Level    m_level;               /// 日志级别
+    uint64_t           m_time;                /// 记录产生时的时钟原始读数
+    BackpressurePolicy m_policy;              /// 缓冲区写满时的处理策略
+    bool               m_overflowed = false;  /// 是否已转存到溢出缓冲区
+    fmt::memory_buffer m_overflow;            /// 超长记录或预留失败时的溢出缓冲区
 };
+
+constexpr uint32_t RingRecordBuffer::kInitialReserve;
 }  // namespace xhong
 
 #endif  // XHONGWHEELS_BLOCKINGBUFFER_H
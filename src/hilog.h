@@ -7,136 +7,210 @@
 
 #include "blockingbuffer.h"
 #include "log_appender.h"
+#include "log_callsite.h"
 #include "log_level.h"
+#include "log_record.h"
 #include "singleton.h"
 #include "timestamp.h"
+#include "tsc_clock.h"
 #include "utils.h"
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <ctime>
+#include <functional>
 #include <memory>
 #include <thread>
 #include <vector>
 
+/**
+ * @brief 编译期日志级别, 与LogLevel::Level的取值一致
+ */
+#define HILOG_LEVEL_DEBUG 1
+#define HILOG_LEVEL_INFO 2
+#define HILOG_LEVEL_WARN 3
+#define HILOG_LEVEL_ERROR 4
+#define HILOG_LEVEL_FATAL 5
+#define HILOG_LEVEL_OFF 6
+
+/**
+ * @brief 编译期生效的最低日志级别, 可在编译选项中指定, 如-DHILOG_ACTIVE_LEVEL=HILOG_LEVEL_INFO
+ * @details 低于该级别的HILOG_DEBUG/HILOG_FMT_DEBUG/HILOGD等宏展开为if (true) {} else ...,
+ *          参数仍然参与类型检查, 但永远不会被求值, 也不会生成任何代码
+ */
+#ifndef HILOG_ACTIVE_LEVEL
+#    define HILOG_ACTIVE_LEVEL HILOG_LEVEL_DEBUG
+#endif
+
+/**
+ * @brief 在编译期丢弃一条日志语句
+ */
+#define HILOG_STRIPPED(...)                                                                        \
+    if (true) {                                                                                    \
+    }                                                                                              \
+    else                                                                                           \
+        __VA_ARGS__
+
+#if HILOG_ACTIVE_LEVEL <= HILOG_LEVEL_DEBUG
+#    define HILOG_ACTIVE_DEBUG(...) __VA_ARGS__
+#else
+#    define HILOG_ACTIVE_DEBUG(...) HILOG_STRIPPED(__VA_ARGS__)
+#endif
+
+#if HILOG_ACTIVE_LEVEL <= HILOG_LEVEL_INFO
+#    define HILOG_ACTIVE_INFO(...) __VA_ARGS__
+#else
+#    define HILOG_ACTIVE_INFO(...) HILOG_STRIPPED(__VA_ARGS__)
+#endif
+
+#if HILOG_ACTIVE_LEVEL <= HILOG_LEVEL_WARN
+#    define HILOG_ACTIVE_WARN(...) __VA_ARGS__
+#else
+#    define HILOG_ACTIVE_WARN(...) HILOG_STRIPPED(__VA_ARGS__)
+#endif
+
+#if HILOG_ACTIVE_LEVEL <= HILOG_LEVEL_ERROR
+#    define HILOG_ACTIVE_ERROR(...) __VA_ARGS__
+#else
+#    define HILOG_ACTIVE_ERROR(...) HILOG_STRIPPED(__VA_ARGS__)
+#endif
+
+#if HILOG_ACTIVE_LEVEL <= HILOG_LEVEL_FATAL
+#    define HILOG_ACTIVE_FATAL(...) __VA_ARGS__
+#else
+#    define HILOG_ACTIVE_FATAL(...) HILOG_STRIPPED(__VA_ARGS__)
+#endif
+
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
+ * @details 每个调用点定义一个静态描述符, 日志事件只携带指向它的指针;
+ *          级别判断读取调用点的静态缓存; 日志事件位于栈上, 不分配堆内存
  */
 #define HILOG_LEVEL(logger, level)                                                                 \
-    if (logger->getLevel() <= level)                                                               \
-    xhong::LogEventWrap(xhong::BasicLogEvent::ptr(new xhong::BasicLogEvent(                        \
-                            logger, level, __FILE__, __LINE__, clock(), xhong::GetThreadId(), 0,   \
-                            xhong::Timestamp::GetCurrentTimestamp(), " ")))                        \
-                                                                                                   \
-        .getBasicEvent()                                                                           \
-        ->getSstream()
+    for (bool hilogOnce = true; hilogOnce; hilogOnce = false)                                      \
+        for (HILOG_DEFINE_CALLSITE(hilogCallSite, level, nullptr); hilogOnce; hilogOnce = false)   \
+            for (HILOG_DEFINE_LEVEL_CACHE(hilogLevelCache); hilogOnce; hilogOnce = false)          \
+                if (XHONG_LIKELY(!hilogLevelCache.isEnabled(*logger, level))) {                    \
+                }                                                                                  \
+                else                                                                               \
+                    xhong::LogEventWrap(&*logger, &hilogCallSite, &xhong::GetThreadContext(), 0,   \
+                                        xhong::TscClock::Now())                                    \
+                        .getBasicEvent()                                                           \
+                        .getSstream()
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
  */
-#define HILOG_DEBUG(logger) HILOG_LEVEL(logger, xhong::LogLevel::DEBUG)
+#define HILOG_DEBUG(logger) HILOG_ACTIVE_DEBUG(HILOG_LEVEL(logger, xhong::LogLevel::DEBUG))
 
 /**
  * @brief 使用流式方式将日志级别info的日志写入到logger
  */
-#define HILOG_INFO(logger) HILOG_LEVEL(logger, xhong::LogLevel::INFO)
+#define HILOG_INFO(logger) HILOG_ACTIVE_INFO(HILOG_LEVEL(logger, xhong::LogLevel::INFO))
 
 /**
  * @brief 使用流式方式将日志级别warn的日志写入到logger
  */
-#define HILOG_WARN(logger) HILOG_LEVEL(logger, xhong::LogLevel::WARN)
+#define HILOG_WARN(logger) HILOG_ACTIVE_WARN(HILOG_LEVEL(logger, xhong::LogLevel::WARN))
 
 /**
  * @brief 使用流式方式将日志级别error的日志写入到logger
  */
-#define HILOG_ERROR(logger) HILOG_LEVEL(logger, xhong::LogLevel::ERROR)
+#define HILOG_ERROR(logger) HILOG_ACTIVE_ERROR(HILOG_LEVEL(logger, xhong::LogLevel::ERROR))
 
 /**
  * @brief 使用流式方式将日志级别fatal的日志写入到logger
  */
-#define HILOG_FATAL(logger) HILOG_LEVEL(logger, xhong::LogLevel::FATAL)
+#define HILOG_FATAL(logger) HILOG_ACTIVE_FATAL(HILOG_LEVEL(logger, xhong::LogLevel::FATAL))
 
 /**
  * @brief 使用格式化方式将日志级别level的日志写入到logger
+ * @details 调用点只保留级别判断与一次函数调用, 格式化与写日志在冷路径函数
+ *          Logger::logPrintf中完成
  */
 #define HILOG_FMT_LEVEL(logger, level, fmt, ...)                                                   \
-    if (logger->getLevel() <= level)                                                               \
-    xhong::LogEventWrap(xhong::BasicLogEvent::ptr(new xhong::BasicLogEvent(                        \
-                            logger, level, __FILE__, __LINE__, clock(), xhong::GetThreadId(), 0,   \
-                            xhong::Timestamp::GetCurrentTimestamp(), " ")))                        \
-                                                                                                   \
-        .getBasicEvent()                                                                           \
-        ->format(fmt, __VA_ARGS__)
+    do {                                                                                           \
+        HILOG_DEFINE_CALLSITE(hilogCallSite, level, fmt);                                          \
+        HILOG_DEFINE_LEVEL_CACHE(hilogLevelCache);                                                 \
+        if (XHONG_UNLIKELY(hilogLevelCache.isEnabled(*logger, level))) {                           \
+            logger->logPrintf(hilogCallSite, fmt, __VA_ARGS__);                                    \
+        }                                                                                          \
+    } while (0)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
  */
 #define HILOG_FMT_DEBUG(logger, fmt, ...)                                                          \
-    HILOG_FMT_LEVEL(logger, xhong::LogLevel::DEBUG, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_DEBUG(HILOG_FMT_LEVEL(logger, xhong::LogLevel::DEBUG, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别info的日志写入到logger
  */
 #define HILOG_FMT_INFO(logger, fmt, ...)                                                           \
-    HILOG_FMT_LEVEL(logger, xhong::LogLevel::INFO, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_INFO(HILOG_FMT_LEVEL(logger, xhong::LogLevel::INFO, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别warn的日志写入到logger
  */
 #define HILOG_FMT_WARN(logger, fmt, ...)                                                           \
-    HILOG_FMT_LEVEL(logger, xhong::LogLevel::WARN, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_WARN(HILOG_FMT_LEVEL(logger, xhong::LogLevel::WARN, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别error的日志写入到logger
  */
 #define HILOG_FMT_ERROR(logger, fmt, ...)                                                          \
-    HILOG_FMT_LEVEL(logger, xhong::LogLevel::ERROR, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_ERROR(HILOG_FMT_LEVEL(logger, xhong::LogLevel::ERROR, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别fatal的日志写入到logger
  */
 #define HILOG_FMT_FATAL(logger, fmt, ...)                                                          \
-    HILOG_FMT_LEVEL(logger, xhong::LogLevel::FATAL, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_FATAL(HILOG_FMT_LEVEL(logger, xhong::LogLevel::FATAL, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用现代格式化方式将日志级别level的日志写入到logger
+ * @details 日志器开启延迟格式化且fmt是字符串字面量时, 调用线程只拷贝原始参数,
+ *          格式化交给后台线程; 除级别判断外的代码都在冷路径函数Logger::logModern中,
+ *          不会内联进调用者
  */
 #define HILOG_MODERN_FMT_LEVEL(logger, level, fmt, ...)                                            \
-    if (logger->getLevel() <= level)                                                               \
-    xhong::LogEventWrap(xhong::FmtLogEvent::ptr(new xhong::FmtLogEvent(                            \
-                            logger, level, __FILE__, __LINE__, clock(), xhong::GetThreadId(), 0,   \
-                            xhong::Timestamp::GetCurrentTimestamp(), " ")))                        \
-                                                                                                   \
-        .getFmtEvent()                                                                             \
-        ->modernFormat(fmt, __VA_ARGS__)
+    do {                                                                                           \
+        HILOG_DEFINE_CALLSITE(hilogCallSite, level, fmt);                                          \
+        HILOG_DEFINE_LEVEL_CACHE(hilogLevelCache);                                                 \
+        if (XHONG_UNLIKELY(hilogLevelCache.isEnabled(*logger, level))) {                           \
+            logger->logModern(hilogCallSite, fmt, __VA_ARGS__);                                    \
+        }                                                                                          \
+    } while (0)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
  */
 #define HILOGD(logger, fmt, ...)                                                                   \
-    HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::DEBUG, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_DEBUG(HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::DEBUG, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别info的日志写入到logger
  */
 #define HILOGI(logger, fmt, ...)                                                                   \
-    HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::INFO, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_INFO(HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::INFO, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别warn的日志写入到logger
  */
 #define HILOGW(logger, fmt, ...)                                                                   \
-    HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::WARN, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_WARN(HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::WARN, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别error的日志写入到logger
  */
 #define HILOGE(logger, fmt, ...)                                                                   \
-    HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::ERROR, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_ERROR(HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::ERROR, fmt, __VA_ARGS__))
 
 /**
  * @brief 使用格式化方式将日志级别fatal的日志写入到logger
  */
 #define HILOGF(logger, fmt, ...)                                                                   \
-    HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::FATAL, fmt, __VA_ARGS__)
+    HILOG_ACTIVE_FATAL(HILOG_MODERN_FMT_LEVEL(logger, xhong::LogLevel::FATAL, fmt, __VA_ARGS__))
 
 /**
  * @brief 获取主日志器
@@ -149,11 +223,360 @@
 #define HILOG_NAME(name) xhong::Singleton<xhong::LoggerManager>::GetInstance()->getLogger(name)
 
 namespace xhong {
+class Logger;
+
+/**
+ * @brief 所有加速模式日志器共用的日志后台
+ * @details 每个写日志的线程只有一个线程缓冲区, 记录头部标明所属的日志器;
+ *          一个后台线程读取全部线程缓冲区, 按日志器分组渲染后交给各自的日志目标.
+ *          线程数与缓冲区内存不随日志器数量增长. 与分段池一样有意不析构,
+ *          进程退出时仍在写日志的线程不受静态对象析构顺序的影响
+ */
+class LogBackend {
+  public:
+    /**
+     * @brief 后台线程的唤醒策略
+     */
+    struct WakeupPolicy {
+        enum Mode : uint8_t {
+            // 缓冲区全部读空后挂起, 生产者在缓冲区由空变为非空时唤醒
+            ADAPTIVE = 0,
+            // 同ADAPTIVE, 被唤醒后再等待最多interval微秒攒批,
+            // 期间生产者的分段写入量越过watermark时提前结束等待
+            BATCH = 1,
+            // 不挂起, 每轮之间睡眠interval微秒, interval为0时只让出CPU
+            BUSY_POLL = 2
+        };
+
+        Mode     mode      = ADAPTIVE;   /// 唤醒方式
+        uint32_t interval  = 1000;       /// BATCH的攒批时长, BUSY_POLL的轮询间隔(微秒)
+        uint32_t watermark = 32 * 1024;  /// BATCH提前唤醒的分段写入量(字节)
+        uint32_t spins     = 16;         /// ADAPTIVE与BATCH挂起前空读的轮数
+    };
+
+    /**
+     * @brief 返回进程内唯一的日志后台, 首次调用时启动后台线程
+     */
+    static LogBackend& Instance() {
+        static LogBackend* backend = new LogBackend;
+        return *backend;
+    }
+
+    LogBackend(const LogBackend&) = delete;
+    LogBackend& operator=(const LogBackend&) = delete;
+
+    /**
+     * @brief 设置后台线程的唤醒策略
+     */
+    void setWakeupPolicy(const WakeupPolicy& policy);
+
+    /**
+     * @brief 获取后台线程的唤醒策略
+     */
+    WakeupPolicy getWakeupPolicy() const {
+        return m_config.load(std::memory_order_acquire)->wakeup;
+    }
+
+    /**
+     * @brief 设置有序输出的重排窗口
+     * @param[in] windowUs 重排窗口(微秒), 0表示关闭有序输出(默认)
+     * @details 开启后后台线程把各线程的记录暂存windowUs微秒, 再按记录产生时间归并输出;
+     *          提交晚于窗口的记录不保证顺序. 窗口越大, 乱序越少, 输出延迟与暂存内存越大.
+     *          顺序在同一日志器的记录之间成立, 不同日志器的日志目标各自输出
+     */
+    void setReorderWindow(uint32_t windowUs);
+
+    /**
+     * @brief 获取有序输出的重排窗口(微秒), 0表示关闭
+     */
+    uint32_t getReorderWindow() const {
+        return m_config.load(std::memory_order_acquire)->reorderWindow;
+    }
+
+    /**
+     * @brief 注册日志器, 之后后台线程定时刷新它的日志目标并报告它的丢弃计数
+     */
+    void registerLogger(Logger* logger);
+
+    /**
+     * @brief 注销日志器, 返回前输出该日志器已提交的全部记录
+     */
+    void unregisterLogger(Logger* logger);
+
+    /**
+     * @brief 等待后台线程输出调用前已提交的全部记录, 包括有序输出暂存的记录
+     * @details 后台线程记下请求时各线程缓冲区的生产位置, 归还到这些位置后刷新
+     *          期间写过日志的日志目标即完成, 不等待其他线程停止写日志.
+     *          多个线程可以同时调用, 不能在后台线程中调用
+     */
+    void sync();
+
+    /**
+     * @brief 线程缓冲区的线程局部持有者, 线程退出时标记缓冲区退役
+     */
+    struct ThreadBufferHolder {
+        SegmentedBuffer::ptr buffer;
+
+        ~ThreadBufferHolder() {
+            if (buffer) {
+                buffer->retire();
+            }
+        }
+    };
+
+    /**
+     * @brief 返回当前线程的缓冲区, 各日志器共用, 首次调用时创建
+     */
+    SegmentedBuffer* threadBuffer() {
+        static thread_local ThreadBufferHolder stagingBuffer;  //多线程，多buf
+        if (stagingBuffer.buffer == nullptr) {
+            stagingBuffer.buffer = std::make_shared<SegmentedBuffer>();
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            m_threadBuffersVec.push_back(stagingBuffer.buffer);
+            m_threadContextsVec.push_back(GetThreadContextPtr());
+        }
+        return stagingBuffer.buffer.get();
+    }
+
+    /**
+     * @brief 提交一条记录后按唤醒策略通知后台线程
+     * @param[in] ring 当前线程的缓冲区
+     * @param[in] size 刚提交的记录字节数
+     * @details 与waitForRecords构成Dekker式同步: 生产者先发布记录再读m_sinkWait,
+     *          后台线程先置位m_sinkWait再检查缓冲区. 生产者一侧只需要LightBarrier,
+     *          完整的屏障由后台线程挂起前的HeavyBarrier承担.
+     *          后台线程运行时m_sinkWait为kSinkRunning, 生产者只多一次读取
+     */
+    void notify(SegmentedBuffer* ring, uint32_t size) {
+        const WakeupPolicy& policy = m_config.load(std::memory_order_acquire)->wakeup;
+        if (policy.mode == WakeupPolicy::BUSY_POLL) {
+            return;
+        }
+        LightBarrier();
+        uint32_t state = m_sinkWait.load(std::memory_order_relaxed);
+        if (XHONG_LIKELY(state == kSinkRunning)) {
+            return;
+        }
+        if (state == kSinkBatching) {
+            // 攒批期间只在本线程的分段写入量越过水位时唤醒.
+            uint32_t fill = ring->getFill();
+            if (fill < policy.watermark ||
+                fill - std::min(fill, LogRecordHeader::Align(size)) >= policy.watermark) {
+                return;
+            }
+        }
+        wakeSink();
+    }
+
+  private:
+    /**
+     * @brief 后台的只读配置快照, 发布方式同Logger::Snapshot
+     */
+    struct Config {
+        WakeupPolicy wakeup;         /// 后台线程的唤醒策略
+        uint32_t     reorderWindow;  /// 有序输出的重排窗口(微秒), 0为关闭
+    };
+
+    LogBackend();
+
+    /**
+     * @brief 根据当前配置发布新快照, 调用方需持有m_mutex
+     */
+    void publishConfig();
+
+    /**
+     * @brief 后台线程主循环
+     */
+    void sinkThread();
+
+    /**
+     * @brief 将取出的记录依次交给各自的日志器, 参见renderRecord
+     * @param[in] data 记录起始地址
+     * @param[in] size 记录总字节数, 只包含完整记录
+     */
+    void renderRecords(const char* data, uint32_t size);
+
+    /**
+     * @brief 把一条记录的输出追加到所属日志器本批的片段列表
+     * @param[in] record 记录起始地址, 不能是填充记录
+     * @details 已格式化的文本不拷贝, 片段直接指向记录所在的内存, 输出前它不会被复用;
+     *          延迟格式化记录渲染到日志器的渲染缓冲区
+     */
+    void renderRecord(const char* record);
+
+    /**
+     * @brief 日志器本批首次有输出时加入m_batchLoggers
+     */
+    void touchLogger(Logger* logger);
+
+    /**
+     * @brief 为渲染缓冲区末尾新增的size字节追加片段, 与前一个同级别的渲染片段相邻时合并
+     * @details 渲染缓冲区在一批内可能扩容, 片段先不记地址, 输出时按顺序换算
+     */
+    void addRenderedSpan(Logger* logger, size_t size, LogLevel::Level level);
+
+    /**
+     * @brief 有序输出时对各线程的暂存队列做k路归并, 依次渲染
+     * @param[in] config 当前配置快照
+     * @details 早于当前时间减去重排窗口的记录按时间顺序输出, 其余记录继续暂存,
+     *          最早的暂存记录到期时刻记入m_nextRelease. 单个线程的记录本身有序,
+     *          小顶堆中每个队列只放队首一条, 弹出后连续输出该队列中不晚于新堆顶的记录.
+     *          晚于窗口到达的记录不再等待, 到达即输出.
+     *          m_drainReorder置位时输出全部暂存记录
+     */
+    void mergeRecords(const Config* config);
+
+    /**
+     * @brief 搬移暂存队列中尚未输出的记录, 必须在本批输出之后调用
+     * @details 输出过半时才搬移, 每个字节平均只搬移常数次
+     */
+    void compactReorderQueues();
+
+    struct ReorderQueue;
+
+    /**
+     * @brief 跳过暂存队列队首的填充记录, 读取队首记录的时间
+     * @param[in] queue 暂存队列
+     * @param[out] time 队首记录的时间(纳秒)
+     * @return 队列是否还有记录
+     */
+    bool peekReorderHead(ReorderQueue& queue, uint64_t& time);
+
+    /**
+     * @brief 把本批各日志器的片段列表交给各自的日志目标
+     * @details 片段带有日志级别, 各日志目标按自己的级别逐段过滤.
+     *          全部日志目标返回后才归还认领的线程缓冲区空间
+     */
+    void outputBatch();
+
+    /**
+     * @brief 空闲时检查已注册日志器的日志目标的定时刷新, 保证低频日志也能按时落盘
+     * @return 距最近一次定时刷新的微秒数, 0表示没有
+     * @details 同时释放突发批次撑大的渲染缓冲区, 日志器再多也只占各自的内联缓冲区
+     */
+    uint64_t flushAppenders();
+
+    /**
+     * @brief 唤醒挂起的后台线程, 多个生产者同时唤醒时只有一个进入系统调用
+     */
+    XHONG_COLD void wakeSink() {
+        if (m_sinkWait.exchange(kSinkRunning, std::memory_order_acq_rel) != kSinkRunning) {
+            FutexWake(&m_sinkWait, 1);
+        }
+    }
+
+    /**
+     * @brief 后台线程读空全部缓冲区后按唤醒策略等待新记录
+     * @param[in] policy 唤醒策略
+     * @param[in] dueUs 距最近一次定时任务(定时刷新或暂存记录到期)的微秒数, 0表示没有
+     * @details 只有定时任务或丢弃报告待处理时才设置超时, 否则一直挂起到生产者唤醒.
+     *          BATCH策略被唤醒后再等待最多interval微秒, 让记录攒成更大的批次
+     */
+    void waitForRecords(const WakeupPolicy& policy, uint64_t dueUs);
+
+    /**
+     * @brief 是否有尚未完成的同步请求
+     * @details sync先递增请求代数再唤醒, 后台线程先置位m_sinkWait再调用本函数,
+     *          两者通过m_condMutex排序, 不会错过唤醒
+     */
+    bool isSyncPending() {
+        std::lock_guard<std::mutex> lock(m_condMutex);
+        return m_syncCompleted != m_syncRequested.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 开始处理新的同步请求, 记下各线程缓冲区当前的生产位置
+     * @details 先在m_condMutex下确定覆盖的代数再读取位置, 这些代数的请求方在请求前
+     *          提交的记录都在记下的位置之前
+     */
+    void beginSync();
+
+    /**
+     * @brief 各线程缓冲区是否都已归还到同步请求记下的位置
+     */
+    bool isSyncReached() const;
+
+    /**
+     * @brief 完成当前的同步请求: 刷新上次同步后写过日志的日志目标, 唤醒等待的线程
+     */
+    void finishSync();
+
+    /**
+     * @brief 线程已经退出且缓冲区读空时移除该缓冲区, 调用方需持有m_bufferMutex
+     * @param[in] idx 缓冲区下标, 移除后最后一个缓冲区换到该位置
+     * @return 是否移除
+     * @details 缓冲区释放时分段归还分段池, 延迟格式化记录引用的线程上下文随之释放,
+     *          此时已经没有记录引用它
+     */
+    bool reclaimThreadBuffer(size_t idx);
+
+    /**
+     * @brief 每隔kDropReportInterval毫秒为丢弃过记录的日志器渲染一行WARN日志
+     * @return 是否渲染了日志
+     */
+    bool renderDropReport();
+
+    std::mutex                           m_mutex;             /// Mutex, 只保护配置的写端
+    WakeupPolicy                         m_wakeup;            /// 后台线程的唤醒策略
+    uint32_t                             m_reorderWindow{0};  /// 有序输出的重排窗口(微秒)
+    std::atomic<const Config*>           m_config{nullptr};   /// 当前配置快照
+    std::vector<std::unique_ptr<Config>> m_configs;           /// 已发布的全部配置快照
+
+    std::mutex           m_loggerMutex;  // guards m_loggers.
+    std::vector<Logger*> m_loggers;      // registered loggers.
+
+    static constexpr uint32_t kSinkRunning  = 0;  // background thread is running.
+    static constexpr uint32_t kSinkIdle     = 1;  // sleeping until any record is committed.
+    static constexpr uint32_t kSinkBatching = 2;  // sleeping until a watermark is crossed.
+    std::atomic<uint32_t> m_sinkWait{kSinkRunning};  // background thread state, futex word.
+    uint32_t              m_idleRounds{0};             // empty rounds since last batch.
+
+    bool                              m_outputFullFlag{false};      // output buffer full flag.
+    uint32_t                          m_oneTimeConsumeBytes{0};     // bytes consumed per loop.
+    uint32_t                          m_outputBufferSize{1 << 20};  // max bytes per batch.
+    std::vector<SegmentedBuffer::ptr> m_claimedBuffers;  // claimed in place until output.
+    std::vector<LogSpan>              m_claimedSpans;    // records claimed in this batch.
+
+    std::vector<Logger*> m_batchLoggers;  // loggers with rendered text in this batch.
+    static constexpr size_t kRenderBufferKeep = 64 * 1024;  // render buffer kept while idle.
+
+    /**
+     * @brief 有序输出时一个线程缓冲区中已取出但尚未输出的记录
+     */
+    struct ReorderQueue {
+        fmt::memory_buffer records;   /// 取出的完整记录
+        size_t             head = 0;  /// 下一条待输出记录的偏移
+    };
+    std::vector<ReorderQueue> m_reorderQueues;  // per thread buffer, ordered output only.
+    std::vector<std::pair<uint64_t, uint32_t>> m_mergeHeap;  // (time ns, queue index).
+    uint64_t m_nextRelease{0};     // release time of the oldest held record, ns, 0 if none.
+    bool     m_drainReorder{false};  // release all held records in the next pass.
+    FmtLogEvent m_deferredEvent{nullptr, nullptr, nullptr, 0, 0};  // reused by sink thread.
+
+    static constexpr uint64_t kDropReportInterval = 1000;  // drop report period, ms.
+    uint64_t                  m_lastDropReport{0};         // last drop report time, steady ms.
+
+    std::atomic<uint64_t>   m_syncRequested{0};  // sync generations requested, m_condMutex.
+    uint64_t                m_syncStarted{0};    // generations covered by m_syncTargets.
+    uint64_t                m_syncCompleted{0};  // generations fully written out.
+    std::mutex              m_condMutex;
+    std::condition_variable m_syncCond;  // signaled when m_syncCompleted advances.
+    std::vector<std::pair<SegmentedBuffer::ptr, SegmentedBuffer::Position>>
+                         m_syncTargets;  // produced positions when the sync began.
+    std::vector<Logger*> m_syncLoggers;  // loggers with output since the last sync.
+
+    std::vector<SegmentedBuffer::ptr> m_threadBuffersVec;
+    std::vector<ThreadContext::ptr>   m_threadContextsVec;  // referenced by deferred records.
+    std::thread                       m_sinkThread;
+    std::mutex                        m_bufferMutex;  // internel buffer mutex.
+};
+
 /**
  * @brief 日志器
  */
 class Logger : public std::enable_shared_from_this<Logger> {
     friend class LoggerManager;
+    friend class LogBackend;
 
   public:
     using ptr = std::shared_ptr<Logger>;
@@ -163,38 +586,29 @@ class Logger : public std::enable_shared_from_this<Logger> {
      * @param[in] name 日志器名称
      */
     Logger(const std::string& name = "root", const bool accFlag = true)
-        : m_name(name), m_level(LogLevel::DEBUG), m_accelerateFlag(accFlag),
-          m_outputBufferSize(1 << 25) {
-        m_formatter.reset(
-            new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T[%p]%T%f:%l%T%m%n"));  //"%d{%Y-%m-%d
+        : m_name(name), m_id(NextId()), m_level(LogLevel::DEBUG), m_accelerateFlag(accFlag) {
+        // 保证时钟先于日志器构造, 日志器析构时仍可以换算时间戳.
+        TscClock::StartNanoseconds();
+        m_formatter.reset(new StaticLogFormatter<DefaultLogPattern>);  //"%d{%Y-%m-%d
         //%H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"
+        publishSnapshot();
         // linit
         if (m_accelerateFlag) {
-            m_outputBuffer = static_cast<char*>(malloc(m_outputBufferSize));
-            m_sinkThread   = std::thread(&Logger::sinkThread, this);
+            m_backend = &LogBackend::Instance();
+            m_backend->registerLogger(this);
         }
     }
 
     ~Logger() {
-        if (m_accelerateFlag) {
-            // notify background thread befor the object detoryed.
-            std::unique_lock<std::mutex> lock(m_condMutex);
-            m_threadEndSyncFlag = true;
-            m_proceedCond.notify_all();
-            m_hitEmptyCond.wait(lock);
+        if (m_backend != nullptr) {
+            // 后台输出完本日志器已提交的记录后, 不再有记录引用本日志器.
+            m_backend->unregisterLogger(this);
         }
 
-        {
-            // stop sink thread.
-            std::lock_guard<std::mutex> lock(m_condMutex);
-            m_threadEndFlag = true;
-            m_proceedCond.notify_all();
+        for (auto& appender : m_appenders) {
+            appender->flush();
         }
 
-        if (m_sinkThread.joinable())
-            m_sinkThread.join();
-
-        free(m_outputBuffer);
         // todo:只能指针数组buf释放
     }
 
@@ -235,7 +649,14 @@ class Logger : public std::enable_shared_from_this<Logger> {
      * @param[in] level 日志级别
      * @param[in] event 日志事件
      */
-    void log(LogLevel::Level level, LogEvent::ptr event);
+    void log(LogLevel::Level level, const LogEvent& event);
+
+    /**
+     * @brief 写日志
+     * @param[in] level 日志级别
+     * @param[in] event 日志事件
+     */
+    void log(LogLevel::Level level, LogEvent::ptr event) { log(level, *event); }
 
     /**
      * @brief 写debug级别日志
@@ -270,106 +691,222 @@ class Logger : public std::enable_shared_from_this<Logger> {
     /**
      * @brief 返回日志级别
      */
-    LogLevel::Level getLevel() const { return m_level; }
+    LogLevel::Level getLevel() const { return m_level.load(std::memory_order_relaxed); }
 
     /**
      * @brief 设置日志级别
+     * @details 写入级别后递增全局代数, 所有调用点的级别缓存随之失效, 立即对各线程生效
+     */
+    void setLevel(LogLevel::Level level) {
+        m_level.store(level, std::memory_order_relaxed);
+        LogLevelGeneration().fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 返回日志器ID, 进程内唯一, 用于调用点级别缓存
      */
-    void setLevel(LogLevel::Level level) { m_level = level; }
+    uint32_t getId() const { return m_id; }
 
     /**
      * @brief 返回日志名称
      */
     const std::string& getName() const { return m_name; }
 
-    void produceLog(const char* data, uint32_t size) { blockingBuffer()->produce(data, size); }
-
-    CircleBlockingBuffer::ptr blockingBuffer() {
-        static thread_local CircleBlockingBuffer::ptr stagingBuffer = nullptr;  //多线程，多buf
-        if (stagingBuffer == nullptr) {
-            std::unique_lock<std::mutex> lock(m_bufferMutex);
-            lock.unlock();
-            stagingBuffer = std::make_shared<CircleBlockingBuffer>(m_outputBufferSize);
-            lock.lock();
-            m_threadBuffersVec.push_back(stagingBuffer);
-        }
-        return stagingBuffer;
-    }
-
-    void sinkThread() {
-        while (!m_threadEndFlag) {
-            {
-                std::lock_guard<std::mutex> lock(m_bufferMutex);
-                uint32_t                    bufferIdx = 0;
-                while (!m_threadEndFlag && !m_outputFullFlag &&
-                       (bufferIdx < m_threadBuffersVec.size())) {
-                    CircleBlockingBuffer::ptr circleBlockingBuffer = m_threadBuffersVec[bufferIdx];
-                    uint32_t                  consumableBytes = circleBlockingBuffer->getUsedSize();
-
-                    if (m_outputBufferSize - m_oneTimeConsumeBytes < consumableBytes) {
-                        m_outputFullFlag = true;
-                        break;
-                    }
+    /**
+     * @brief 是否开启延迟格式化
+     */
+    bool isDeferred() const { return m_deferredFlag.load(std::memory_order_relaxed); }
 
-                    if (consumableBytes > 0) {
-                        uint32_t consumeBytes = circleBlockingBuffer->consume(
-                            m_outputBuffer + m_oneTimeConsumeBytes, consumableBytes);
-                        m_oneTimeConsumeBytes += consumeBytes;
+    /**
+     * @brief 设置是否延迟格式化, 只在加速模式下生效
+     * @details 开启后HILOGD等宏只在调用线程拷贝时间戳与原始参数,
+     *          fmt格式化与模板格式化全部在后台线程完成
+     */
+    void setDeferred(bool deferred) {
+        m_deferredFlag.store(m_accelerateFlag && deferred, std::memory_order_relaxed);
+    }
 
-                    }
-                    else {
+    /**
+     * @brief 设置线程缓冲区写满时的处理策略, 只在加速模式下生效
+     */
+    void setBackpressurePolicy(const BackpressurePolicy& policy);
 
-                    }
-                    bufferIdx++;
-                }
-            }
+    /**
+     * @brief 获取线程缓冲区写满时的处理策略
+     */
+    BackpressurePolicy getBackpressurePolicy() const {
+        return m_snapshot.load(std::memory_order_acquire)->backpressure;
+    }
 
-            // not data to sink, go to sleep, 50us.
-            if (m_oneTimeConsumeBytes == 0) {
-                std::unique_lock<std::mutex> lock(m_condMutex);
+    /**
+     * @brief 以延迟格式化方式写日志
+     * @param[in] call_site 调用点描述符
+     * @param[in] fmt 格式字符串, 与调用点描述符中的一致
+     * @param[in] args 格式化参数
+     * @details 参数中含有无法序列化的类型或格式字符串不是字面量时, 退回到调用线程格式化
+     */
+    template <typename... Args>
+    void logDeferred(const LogCallSite&          call_site,
+                     fmt::format_string<Args...> fmt,
+                     Args&&... args) {
+        logDeferred(std::integral_constant<bool, DeferredArgs<Args...>::supported>(), call_site,
+                    fmt, std::forward<Args>(args)...);
+    }
 
-                // if front-end generated sync operation, consume again.
-                if (m_threadEndSyncFlag) {
-                    m_threadEndSyncFlag = false;
-                    continue;
-                }
+    /**
+     * @brief HILOG_FMT_*宏的冷路径, 在调用线程按printf格式写日志
+     * @param[in] call_site 调用点描述符
+     * @param[in] fmt printf格式字符串
+     * @param[in] args 格式化参数
+     * @details 按参数类型列表实例化, 不内联且放入冷代码段, 避免膨胀调用者
+     */
+    template <typename... Args>
+    XHONG_COLD void logPrintf(const LogCallSite& call_site, const char* fmt, const Args&... args);
 
-                m_hitEmptyCond.notify_one();
-                m_proceedCond.wait_for(lock, std::chrono::microseconds(50));
-            }
-            else {
-                for (auto& appender : m_appenders) {
-                    appender->log(m_level, m_outputBuffer, m_oneTimeConsumeBytes);
-                }
-                m_oneTimeConsumeBytes = 0;
-                m_outputFullFlag      = false;
+    /**
+     * @brief HILOGD等宏的冷路径, 按是否延迟格式化写日志
+     * @param[in] call_site 调用点描述符
+     * @param[in] fmt 格式字符串
+     * @param[in] args 格式化参数
+     * @details 按参数类型列表实例化, 不内联且放入冷代码段, 避免膨胀调用者
+     */
+    template <typename... Args>
+    XHONG_COLD void logModern(const LogCallSite&          call_site,
+                              fmt::format_string<Args...> fmt,
+                              const Args&... args);
+
+    /**
+     * @brief 将一条已格式化的日志文本写入当前线程的缓冲区
+     * @details 未开启加速时没有后台与线程缓冲区, 直接交给日志目标
+     */
+    void produceLog(const char* data, uint32_t size, LogLevel::Level level = LogLevel::INFO) {
+        const Snapshot* snapshot = m_snapshot.load(std::memory_order_acquire);
+        if (m_backend == nullptr) {
+            LogSpan span{data, size, level};
+            for (auto& appender : snapshot->appenders) {
+                appender->log(&span, 1);
             }
+            return;
+        }
+        SegmentedBuffer* ring     = m_backend->threadBuffer();
+        uint64_t         dropped  = ring->getDropped();
+        RingRecordBuffer record(*ring, this, level, TscClock::Now(), snapshot->backpressure);
+        record.append(data, data + size);
+        bool committed = record.commit(LogRecordHeader::TEXT);
+        countDropped(ring, dropped);
+        if (committed) {
+            m_backend->notify(ring, size);
         }
     }
 
   private:
-    std::string                 m_name;       /// 日志名称
-    LogLevel::Level             m_level;      /// 日志级别
-    std::mutex                  m_mutex;      /// Mutex
-    std::list<LogAppender::ptr> m_appenders;  /// 日志目标集合
-    LogFormatter::ptr           m_formatter;  /// 日志格式器
-    Logger::ptr                 m_root;       /// 主日志器
-
-    bool m_accelerateFlag{true};
-    bool m_threadEndSyncFlag{false};  // front-back-end sync.
-    bool m_threadEndFlag{false};      // background thread exit flag.
-    bool m_outputFullFlag{false};     // output buffer full flag.
-
-    uint32_t m_oneTimeConsumeBytes{0};             // bytes of consume first-end data per loop.
-    uint32_t m_outputBufferSize{2 * 1024 * 1024};  // two buffer size.
-    char*    m_outputBuffer{nullptr};              // first internal buffer.
-
-    std::vector<CircleBlockingBuffer::ptr> m_threadBuffersVec;
-    std::thread                            m_sinkThread;
-    std::mutex                             m_bufferMutex;  // internel buffer mutex.
-    std::mutex                             m_condMutex;
-    std::condition_variable                m_proceedCond;   // for background thread to proceed.
-    std::condition_variable                m_hitEmptyCond;  // for no data to consume.
+    /**
+     * @brief 分配新的日志器ID, 从1开始
+     */
+    static uint32_t NextId() {
+        static std::atomic<uint32_t> nextId{1};
+        return nextId.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 日志格式器与日志目标的只读快照
+     * @details 写端(setFormatter/addAppender等)在m_mutex保护下生成新快照并原子替换,
+     *          读端(log与后台线程)只做一次acquire读取, 不再持有任何共享锁
+     */
+    struct Snapshot {
+        LogFormatter::ptr             formatter;     /// 日志格式器
+        std::vector<LogAppender::ptr> appenders;     /// 日志目标集合
+        BackpressurePolicy            backpressure;  /// 线程缓冲区写满时的处理策略
+    };
+
+    /**
+     * @brief 根据当前配置发布新快照, 调用方需持有m_mutex
+     * @details 旧快照可能仍被其他线程读取, 统一保留到日志器析构时释放;
+     *          配置变更频率很低, 保留的内存可以忽略
+     */
+    void publishSnapshot() {
+        std::unique_ptr<Snapshot> snapshot(new Snapshot);
+        snapshot->formatter = m_formatter;
+        snapshot->appenders.assign(m_appenders.begin(), m_appenders.end());
+        snapshot->backpressure = m_backpressure;
+        m_snapshot.store(snapshot.get(), std::memory_order_release);
+        m_snapshots.push_back(std::move(snapshot));
+    }
+
+    /**
+     * @brief 返回本次调用使用的调用点描述符
+     * @param[in] call_site 宏定义的调用点描述符
+     * @param[in] format 格式字符串
+     * @param[out] runtime 格式字符串不是字面量时, 在此补全描述符, 只在本次调用期间有效
+     */
+    template <typename S>
+    static const LogCallSite& ResolveCallSite(const LogCallSite& call_site,
+                                              const S&           format,
+                                              LogCallSite&       runtime) {
+        if (XHONG_LIKELY(call_site.fmt != nullptr)) {
+            return call_site;
+        }
+        fmt::string_view str = format;
+        runtime              = call_site;
+        runtime.fmt          = str.data();
+        runtime.fmtSize      = static_cast<uint32_t>(str.size());
+        return runtime;
+    }
+
+    /**
+     * @brief 把写入一条记录期间线程缓冲区新增的丢弃计数记到本日志器
+     * @param[in] ring 当前线程的缓冲区
+     * @param[in] dropped 写入前缓冲区的丢弃计数
+     * @details 线程缓冲区由各日志器共用, 覆盖最旧记录时被覆盖的记录也计入写入方
+     */
+    void countDropped(SegmentedBuffer* ring, uint64_t dropped) {
+        uint64_t now = ring->getDropped();
+        if (XHONG_UNLIKELY(now != dropped)) {
+            m_dropped.fetch_add(now - dropped, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 序列化原始参数写入当前线程的缓冲区
+     */
+    template <typename... Args>
+    void logDeferred(std::true_type,
+                     const LogCallSite&          call_site,
+                     fmt::format_string<Args...> fmt,
+                     Args&&... args);
+
+    /**
+     * @brief 在调用线程格式化后写日志
+     */
+    template <typename... Args>
+    void logDeferred(std::false_type,
+                     const LogCallSite&          call_site,
+                     fmt::format_string<Args...> fmt,
+                     Args&&... args);
+
+    std::string                  m_name;          /// 日志名称
+    const uint32_t               m_id;            /// 日志器ID
+    std::atomic<LogLevel::Level> m_level;         /// 日志级别
+    std::mutex                   m_mutex;         /// Mutex, 只保护配置的写端
+    std::list<LogAppender::ptr>  m_appenders;     /// 日志目标集合
+    LogFormatter::ptr            m_formatter;     /// 日志格式器
+    Logger::ptr                  m_root;          /// 主日志器
+    BackpressurePolicy           m_backpressure;  /// 线程缓冲区写满时的处理策略
+
+    std::atomic<const Snapshot*>           m_snapshot{nullptr};  /// 当前快照
+    std::vector<std::unique_ptr<Snapshot>> m_snapshots;          /// 已发布的全部快照
+
+    bool              m_accelerateFlag{true};
+    std::atomic<bool> m_deferredFlag{false};  // format on background thread.
+    LogBackend*       m_backend{nullptr};     // shared backend, null if not accelerated.
+    std::atomic<uint64_t> m_dropped{0};       // records dropped while logging to this logger.
+
+    // 以下只由后台线程访问.
+    std::vector<LogSpan> m_spans;             // output of the current batch.
+    fmt::memory_buffer   m_renderBuffer;      // text of spans with null data.
+    bool                 m_inBatch{false};    // listed in m_batchLoggers.
+    bool                 m_inSync{false};     // listed in m_syncLoggers.
+    uint64_t             m_reportedDrops{0};  // drops already reported.
 };
 
 /**
@@ -406,50 +943,34 @@ class LoggerManager {
 
 /**
  * @brief 日志事件包装器
+ * @details 作为流式宏中的临时对象直接持有日志事件, 析构时写日志
  */
 class LogEventWrap {
   public:
     /**
      * @brief 构造函数
-     * @param[in] e 日志事件
-     */
-    LogEventWrap(BasicLogEvent::ptr event) : m_basicEvent(event) {}
-    /**
-     * @brief 构造函数
-     * @param[in] e 日志事件
+     * @param[in] args 日志事件构造参数
      */
-    LogEventWrap(FmtLogEvent::ptr event) : m_fmtEvent(event) {}
+    template <typename... Args>
+    XHONG_COLD explicit LogEventWrap(Args&&... args) : m_basicEvent(std::forward<Args>(args)...) {}
 
     /**
      * @brief 析构函数
      */
-    ~LogEventWrap() {
-        if (m_basicEvent) {
-            m_basicEvent->getLogger()->log(m_basicEvent->getLevel(), m_basicEvent);
-        }
-        if (m_fmtEvent) {
-            m_fmtEvent->getLogger()->log(m_fmtEvent->getLevel(), m_fmtEvent);
-        }
+    XHONG_COLD ~LogEventWrap() {
+        m_basicEvent.getLogger()->log(m_basicEvent.getLevel(), m_basicEvent);
     }
 
     /**
      * @brief 获取日志事件
      */
-    BasicLogEvent::ptr getBasicEvent() const { return m_basicEvent; }
-    /**
-     * @brief 获取日志事件
-     */
-    FmtLogEvent::ptr getFmtEvent() const { return m_fmtEvent; }
+    BasicLogEvent& getBasicEvent() { return m_basicEvent; }
 
   private:
     /**
      * @brief 日志事件
      */
-    BasicLogEvent::ptr m_basicEvent{nullptr};
-    /**
-     * @brief 日志事件
-     */
-    FmtLogEvent::ptr m_fmtEvent{nullptr};
+    BasicLogEvent m_basicEvent;
 };
 
 /**
@@ -466,6 +987,7 @@ void Logger::setFormatter(LogFormatter::ptr formatter) {
             appender->m_formatter = m_formatter;
         }
     }
+    publishSnapshot();
 }
 
 void Logger::setFormatter(const std::string& pattern) {
@@ -479,9 +1001,14 @@ void Logger::setFormatter(const std::string& pattern) {
     setFormatter(newformatter);
 }
 
-LogFormatter::ptr Logger::getFormatter() {
+void Logger::setBackpressurePolicy(const BackpressurePolicy& policy) {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_formatter;
+    m_backpressure = policy;
+    publishSnapshot();
+}
+
+LogFormatter::ptr Logger::getFormatter() {
+    return m_snapshot.load(std::memory_order_acquire)->formatter;
 }
 
 void Logger::addAppender(LogAppender::ptr appender) {
@@ -491,6 +1018,7 @@ void Logger::addAppender(LogAppender::ptr appender) {
         appender->m_formatter = m_formatter;
     }
     m_appenders.push_back(appender);
+    publishSnapshot();
 }
 
 void Logger::delAppender(LogAppender::ptr appender) {
@@ -501,23 +1029,35 @@ void Logger::delAppender(LogAppender::ptr appender) {
             break;
         }
     }
+    publishSnapshot();
 }
 
 void Logger::clearAppenders() {
     std::lock_guard<std::mutex> lock(m_mutex);
     m_appenders.clear();
+    publishSnapshot();
 }
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-    if (level >= m_level) {
-        auto                        self = shared_from_this();
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (!m_appenders.empty()) {
-            if (m_accelerateFlag) {
-                std::string str = m_formatter->format(level, event);
-                produceLog(str.c_str(), str.size());
+
+void Logger::log(LogLevel::Level level, const LogEvent& event) {
+    if (level >= getLevel()) {
+        // 快照在日志器析构前一直有效, 生产者之间不再共享任何锁.
+        const Snapshot* snapshot = m_snapshot.load(std::memory_order_acquire);
+        if (!snapshot->appenders.empty()) {
+            if (m_backend != nullptr) {
+                // 直接格式化到线程缓冲区的预留空间, 不经过中间缓冲区.
+                SegmentedBuffer* ring    = m_backend->threadBuffer();
+                uint64_t         dropped = ring->getDropped();
+                RingRecordBuffer record(*ring, this, level, event.getRawTime(),
+                                        snapshot->backpressure);
+                snapshot->formatter->format(record, level, event);
+                bool committed = record.commit(LogRecordHeader::TEXT);
+                countDropped(ring, dropped);
+                if (committed) {
+                    m_backend->notify(ring, static_cast<uint32_t>(record.size()));
+                }
             }
             else {
-                for (auto& appender : m_appenders) {
+                for (auto& appender : snapshot->appenders) {
                     appender->log(level, event);
                 }
             }
@@ -528,6 +1068,581 @@ void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
     }
 }
 
+template <typename... Args>
+void Logger::logPrintf(const LogCallSite& call_site, const char* fmt, const Args&... args) {
+    LogCallSite        runtime;
+    const LogCallSite& site = ResolveCallSite(call_site, fmt, runtime);
+    BasicLogEvent      event(this, &site, &GetThreadContext(), 0, TscClock::Now());
+    event.printfFormat(fmt, args...);
+    log(site.level, event);
+}
+
+template <typename... Args>
+void Logger::logModern(const LogCallSite&          call_site,
+                       fmt::format_string<Args...> fmt,
+                       const Args&... args) {
+    if (isDeferred()) {
+        logDeferred(call_site, fmt, args...);
+    }
+    else {
+        logDeferred(std::false_type(), call_site, fmt, args...);
+    }
+}
+
+template <typename... Args>
+void Logger::logDeferred(std::true_type,
+                         const LogCallSite&          call_site,
+                         fmt::format_string<Args...> fmt,
+                         Args&&... args) {
+    using Codec = DeferredCodec<typename std::decay<Args>::type...>;
+
+    const Snapshot*       snapshot = m_snapshot.load(std::memory_order_acquire);
+    SegmentedBuffer*      ring     = m_backend != nullptr ? m_backend->threadBuffer() : nullptr;
+    size_t                size =
+        sizeof(TimedRecordHeader) + sizeof(DeferredRecordHeader) + Codec::size(args...);
+    // 没有后台时只能在调用线程格式化; 需要转交主日志器时, 主日志器不一定开启了延迟格式化;
+    // 超长记录改为格式化后截断; 非字面量的格式字符串在调用返回后可能失效.
+    if (ring == nullptr || snapshot->appenders.empty() || size > ring->maxRecordSize() ||
+        call_site.fmt == nullptr) {
+        logDeferred(std::false_type(), call_site, fmt, std::forward<Args>(args)...);
+        return;
+    }
+
+    DeferredRecordHeader deferred{&Codec::decode, &call_site, &GetThreadContext()};
+    TimedRecordHeader    header{{static_cast<uint32_t>(size), LogRecordHeader::DEFERRED,
+                              static_cast<uint16_t>(call_site.level)},
+                             TscClock::Now(), this};
+
+    // 参数直接编码到线程缓冲区的预留空间.
+    uint64_t dropped = ring->getDropped();
+    char* p = ring->reserve(static_cast<uint32_t>(size), snapshot->backpressure, call_site.level);
+    if (p == nullptr) {
+        ring->addDropped(1);
+    }
+    countDropped(ring, dropped);
+    if (p == nullptr) {
+        return;
+    }
+    memcpy(p, &header, sizeof(header));
+    memcpy(p + sizeof(header), &deferred, sizeof(deferred));
+    Codec::encode(p + sizeof(header) + sizeof(deferred), args...);
+    ring->commit(static_cast<uint32_t>(size));
+    m_backend->notify(ring, static_cast<uint32_t>(size));
+}
+
+template <typename... Args>
+void Logger::logDeferred(std::false_type,
+                         const LogCallSite&          call_site,
+                         fmt::format_string<Args...> fmt,
+                         Args&&... args) {
+    LogCallSite        runtime;
+    const LogCallSite& site = ResolveCallSite(call_site, fmt, runtime);
+    FmtLogEvent        event(this, &site, &GetThreadContext(), 0, TscClock::Now());
+    event.modernFormat(fmt, std::forward<Args>(args)...);
+    log(site.level, event);
+}
+
+LogBackend::LogBackend() {
+    TscClock::StartNanoseconds();
+    // 提前注册非对称屏障, 生产者的快速路径上不再发生系统调用.
+    AsymmetricBarrierSupported();
+    publishConfig();
+    m_sinkThread = std::thread(&LogBackend::sinkThread, this);
+}
+
+void LogBackend::publishConfig() {
+    std::unique_ptr<Config> config(new Config);
+    config->wakeup        = m_wakeup;
+    config->reorderWindow = m_reorderWindow;
+    m_config.store(config.get(), std::memory_order_release);
+    m_configs.push_back(std::move(config));
+}
+
+void LogBackend::setWakeupPolicy(const WakeupPolicy& policy) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_wakeup = policy;
+    publishConfig();
+    // 挂起中的后台线程按新策略重新等待.
+    wakeSink();
+}
+
+void LogBackend::setReorderWindow(uint32_t windowUs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reorderWindow = windowUs;
+    publishConfig();
+}
+
+void LogBackend::registerLogger(Logger* logger) {
+    std::lock_guard<std::mutex> lock(m_loggerMutex);
+    m_loggers.push_back(logger);
+}
+
+void LogBackend::unregisterLogger(Logger* logger) {
+    sync();
+    std::lock_guard<std::mutex> lock(m_loggerMutex);
+    m_loggers.erase(std::remove(m_loggers.begin(), m_loggers.end(), logger), m_loggers.end());
+}
+
+void LogBackend::sync() {
+    std::unique_lock<std::mutex> lock(m_condMutex);
+    uint64_t generation = m_syncRequested.fetch_add(1, std::memory_order_relaxed) + 1;
+    wakeSink();
+    m_syncCond.wait(lock, [&] { return m_syncCompleted >= generation; });
+}
+
+void LogBackend::beginSync() {
+    {
+        std::lock_guard<std::mutex> lock(m_condMutex);
+        m_syncStarted = m_syncRequested.load(std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    for (auto& buffer : m_threadBuffersVec) {
+        m_syncTargets.emplace_back(buffer, buffer->getProducedPosition());
+    }
+}
+
+bool LogBackend::isSyncReached() const {
+    for (auto& target : m_syncTargets) {
+        if (!target.first->isReleasedPast(target.second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LogBackend::finishSync() {
+    for (Logger* logger : m_syncLoggers) {
+        for (auto& appender : logger->m_snapshot.load(std::memory_order_acquire)->appenders) {
+            appender->flush();
+        }
+        logger->m_inSync = false;
+    }
+    m_syncLoggers.clear();
+    m_syncTargets.clear();
+
+    std::lock_guard<std::mutex> lock(m_condMutex);
+    m_syncCompleted = m_syncStarted;
+    m_syncCond.notify_all();
+}
+
+void LogBackend::sinkThread() {
+    SetThreadName("hilog");
+    for (;;) {
+        const Config* config = m_config.load(std::memory_order_acquire);
+        // 关闭有序输出后先把暂存的记录输出完.
+        bool ordered = config->reorderWindow != 0 || m_nextRelease != 0;
+        bool syncing = m_syncStarted != m_syncCompleted;
+        if (!syncing && m_syncRequested.load(std::memory_order_relaxed) != m_syncStarted) {
+            beginSync();
+            syncing = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            uint32_t                    bufferIdx = 0;
+            if (ordered) {
+                m_reorderQueues.resize(m_threadBuffersVec.size());
+            }
+            while (!m_outputFullFlag && (bufferIdx < m_threadBuffersVec.size())) {
+                SegmentedBuffer::ptr threadBuffer    = m_threadBuffersVec[bufferIdx];
+                uint32_t             consumableBytes = threadBuffer->getUsedSize();
+
+                // 一批至少取一个分段的数据, 超长记录所在的分段可能大于批次上限.
+                if (m_oneTimeConsumeBytes > 0 &&
+                    m_oneTimeConsumeBytes + consumableBytes > m_outputBufferSize) {
+                    m_outputFullFlag = true;
+                    break;
+                }
+
+                if (consumableBytes > 0 && ordered) {
+                    // 有序输出时拷贝到各线程的暂存队列, 记录可能要跨批暂存.
+                    fmt::memory_buffer& output = m_reorderQueues[bufferIdx].records;
+                    size_t              offset = output.size();
+                    output.resize(offset + consumableBytes);
+                    uint32_t consumeBytes =
+                        threadBuffer->consume(output.data() + offset, consumableBytes);
+                    output.resize(offset + consumeBytes);
+                    m_oneTimeConsumeBytes += consumeBytes;
+                }
+                else if (consumableBytes > 0) {
+                    // 否则原地认领, 输出完再归还.
+                    LogSpan  spans[2];
+                    uint32_t claimed = threadBuffer->claim(consumableBytes, spans);
+                    if (claimed > 0) {
+                        m_claimedBuffers.push_back(threadBuffer);
+                        m_claimedSpans.insert(m_claimedSpans.end(), spans, spans + 2);
+                    }
+                    m_oneTimeConsumeBytes += claimed;
+                }
+                else if (reclaimThreadBuffer(bufferIdx)) {
+                    // 最后一个缓冲区已经换到当前位置.
+                    continue;
+                }
+                bufferIdx++;
+            }
+        }
+
+        // 有序输出时取出即归还, 读过同步位置后本轮输出全部暂存记录;
+        // 否则认领的空间在输出后才归还, 输出后再检查.
+        bool syncReached = false;
+        if (syncing && ordered && isSyncReached()) {
+            m_drainReorder = true;
+            syncReached    = true;
+        }
+        if (ordered) {
+            mergeRecords(config);
+        }
+        for (const LogSpan& span : m_claimedSpans) {
+            renderRecords(span.data, static_cast<uint32_t>(span.size));
+        }
+
+        bool idle = m_oneTimeConsumeBytes == 0 && m_batchLoggers.empty();
+        if (!idle) {
+            renderDropReport();
+            outputBatch();
+            for (auto& buffer : m_claimedBuffers) {
+                buffer->release();
+            }
+            m_claimedBuffers.clear();
+            m_claimedSpans.clear();
+            compactReorderQueues();
+            m_oneTimeConsumeBytes = 0;
+            m_outputFullFlag      = false;
+            m_idleRounds          = 0;
+        }
+        if (syncing && (ordered ? syncReached : isSyncReached())) {
+            finishSync();
+        }
+
+        // not data to sink, go to sleep until woken by producers.
+        if (idle) {
+            uint64_t dueUs = flushAppenders();
+            // 暂存的记录到期时醒来输出.
+            if (m_nextRelease != 0) {
+                uint64_t now = TscClock::ToNanoseconds(TscClock::Now());
+                uint64_t due = m_nextRelease > now ? (m_nextRelease - now) / 1000 + 1 : 1;
+                dueUs        = dueUs == 0 ? due : std::min(dueUs, due);
+            }
+
+            if (renderDropReport()) {
+                outputBatch();
+            }
+
+            waitForRecords(config->wakeup, dueUs);
+        }
+    }
+}
+
+void LogBackend::renderRecords(const char* data, uint32_t size) {
+    const char* end = data + size;
+    while (data < end) {
+        LogRecordHeader header;
+        memcpy(&header, data, sizeof(header));
+        if (header.kind != LogRecordHeader::PADDING) {
+            renderRecord(data);
+        }
+        data += LogRecordHeader::Align(header.size);
+    }
+}
+
+void LogBackend::renderRecord(const char* record) {
+    TimedRecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const char* payload = record + sizeof(header);
+
+    Logger* logger = header.logger;
+    touchLogger(logger);
+
+    if (header.header.kind == LogRecordHeader::TEXT) {
+        logger->m_spans.push_back(LogSpan{payload, header.header.size - sizeof(header),
+                                          static_cast<LogLevel::Level>(header.header.level)});
+    }
+    else if (header.header.kind == LogRecordHeader::DEFERRED) {
+        DeferredRecordHeader deferred;
+        memcpy(&deferred, payload, sizeof(deferred));
+        const LogCallSite* site = deferred.callSite;
+        size_t             offset = logger->m_renderBuffer.size();
+        fmt::string_view   format(site->fmt, site->fmtSize);
+        m_deferredEvent.reset(site, deferred.thread, header.time);
+        // 格式错误已由解码函数写成错误提示; 其余异常同样不能终止后台线程.
+        try {
+            deferred.decoder(payload + sizeof(deferred), format, m_deferredEvent.getBuffer());
+        } catch (const std::exception& e) {
+            m_deferredEvent.getBuffer().clear();
+            fmt::format_to(fmt::appender(m_deferredEvent.getBuffer()), "<decode error: {}> {}",
+                           e.what(), format);
+        } catch (...) {
+            m_deferredEvent.getBuffer().clear();
+            fmt::format_to(fmt::appender(m_deferredEvent.getBuffer()), "<decode error> {}", format);
+        }
+        logger->m_snapshot.load(std::memory_order_acquire)
+            ->formatter->format(logger->m_renderBuffer, site->level, m_deferredEvent);
+        addRenderedSpan(logger, logger->m_renderBuffer.size() - offset, site->level);
+    }
+}
+
+void LogBackend::touchLogger(Logger* logger) {
+    if (!logger->m_inBatch) {
+        logger->m_inBatch = true;
+        m_batchLoggers.push_back(logger);
+    }
+}
+
+void LogBackend::addRenderedSpan(Logger* logger, size_t size, LogLevel::Level level) {
+    std::vector<LogSpan>& spans = logger->m_spans;
+    if (!spans.empty() && spans.back().data == nullptr && spans.back().level == level) {
+        spans.back().size += size;
+    }
+    else {
+        spans.push_back(LogSpan{nullptr, size, level});
+    }
+}
+
+void LogBackend::mergeRecords(const Config* config) {
+    uint64_t window = static_cast<uint64_t>(config->reorderWindow) * 1000;
+    uint64_t cutoff = UINT64_MAX;
+    if (!m_drainReorder && window != 0) {
+        cutoff = TscClock::ToNanoseconds(TscClock::Now()) - window;
+    }
+    m_drainReorder = false;
+
+    using HeapCompare = std::greater<std::pair<uint64_t, uint32_t>>;
+    m_mergeHeap.clear();
+    for (uint32_t i = 0; i < m_reorderQueues.size(); ++i) {
+        uint64_t time = 0;
+        if (peekReorderHead(m_reorderQueues[i], time)) {
+            m_mergeHeap.emplace_back(time, i);
+        }
+    }
+    std::make_heap(m_mergeHeap.begin(), m_mergeHeap.end(), HeapCompare());
+    while (!m_mergeHeap.empty() && m_mergeHeap.front().first <= cutoff) {
+        std::pop_heap(m_mergeHeap.begin(), m_mergeHeap.end(), HeapCompare());
+        uint32_t idx = m_mergeHeap.back().second;
+        m_mergeHeap.pop_back();
+
+        // 同一线程的记录本身有序, 连续输出到晚于其他队列的队首为止, 减少堆操作.
+        uint64_t      limit = m_mergeHeap.empty() ? cutoff
+                                                  : std::min(cutoff, m_mergeHeap.front().first);
+        ReorderQueue& queue = m_reorderQueues[idx];
+        uint64_t      time  = 0;
+        do {
+            const char*     record = queue.records.data() + queue.head;
+            LogRecordHeader header;
+            memcpy(&header, record, sizeof(header));
+            renderRecord(record);
+            queue.head += LogRecordHeader::Align(header.size);
+        } while (peekReorderHead(queue, time) && time <= limit);
+
+        if (queue.head < queue.records.size()) {
+            m_mergeHeap.emplace_back(time, idx);
+            std::push_heap(m_mergeHeap.begin(), m_mergeHeap.end(), HeapCompare());
+        }
+    }
+    m_nextRelease = m_mergeHeap.empty() ? 0 : m_mergeHeap.front().first + window;
+}
+
+void LogBackend::compactReorderQueues() {
+    for (auto& queue : m_reorderQueues) {
+        size_t size = queue.records.size();
+        if (queue.head == size) {
+            queue.records.clear();
+            queue.head = 0;
+        }
+        else if (queue.head > size / 2) {
+            memmove(queue.records.data(), queue.records.data() + queue.head, size - queue.head);
+            queue.records.resize(size - queue.head);
+            queue.head = 0;
+        }
+    }
+}
+
+bool LogBackend::peekReorderHead(ReorderQueue& queue, uint64_t& time) {
+    while (queue.head < queue.records.size()) {
+        const char*     record = queue.records.data() + queue.head;
+        LogRecordHeader header;
+        memcpy(&header, record, sizeof(header));
+        if (header.kind != LogRecordHeader::PADDING) {
+            TimedRecordHeader timed;
+            memcpy(&timed, record, sizeof(timed));
+            time = TscClock::ToNanoseconds(timed.time);
+            return true;
+        }
+        queue.head += LogRecordHeader::Align(header.size);
+    }
+    return false;
+}
+
+void LogBackend::outputBatch() {
+    for (Logger* logger : m_batchLoggers) {
+        std::vector<LogSpan>& spans  = logger->m_spans;
+        const char*           render = logger->m_renderBuffer.data();
+        for (LogSpan& span : spans) {
+            if (span.data == nullptr) {
+                span.data = render;
+                render += span.size;
+            }
+        }
+        if (!spans.empty()) {
+            const Logger::Snapshot* snapshot = logger->m_snapshot.load(std::memory_order_acquire);
+            for (auto& appender : snapshot->appenders) {
+                appender->log(spans.data(), spans.size());
+            }
+            if (!logger->m_inSync) {
+                logger->m_inSync = true;
+                m_syncLoggers.push_back(logger);
+            }
+        }
+        spans.clear();
+        logger->m_renderBuffer.clear();
+        logger->m_inBatch = false;
+    }
+    m_batchLoggers.clear();
+}
+
+uint64_t LogBackend::flushAppenders() {
+    uint64_t                    dueUs = 0;
+    std::lock_guard<std::mutex> lock(m_loggerMutex);
+    for (Logger* logger : m_loggers) {
+        for (auto& appender : logger->m_snapshot.load(std::memory_order_acquire)->appenders) {
+            uint64_t due = appender->flushIfDue() * 1000;
+            if (due != 0 && (dueUs == 0 || due < dueUs)) {
+                dueUs = due;
+            }
+        }
+        if (logger->m_renderBuffer.capacity() > kRenderBufferKeep) {
+            logger->m_renderBuffer = fmt::memory_buffer();
+        }
+        if (logger->m_spans.capacity() * sizeof(LogSpan) > kRenderBufferKeep) {
+            std::vector<LogSpan>().swap(logger->m_spans);
+        }
+    }
+    return dueUs;
+}
+
+constexpr uint64_t LogBackend::kDropReportInterval;
+constexpr uint32_t LogBackend::kSinkRunning;
+constexpr uint32_t LogBackend::kSinkIdle;
+constexpr uint32_t LogBackend::kSinkBatching;
+constexpr size_t   LogBackend::kRenderBufferKeep;
+
+void LogBackend::waitForRecords(const WakeupPolicy& policy, uint64_t dueUs) {
+    if (policy.mode == WakeupPolicy::BUSY_POLL) {
+        if (policy.interval == 0) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(std::chrono::microseconds(policy.interval));
+        }
+        return;
+    }
+    // 先空读几轮, 持续写入时后台线程很少挂起, 生产者也就很少需要唤醒它.
+    if (++m_idleRounds <= policy.spins) {
+        std::this_thread::yield();
+        return;
+    }
+
+    uint64_t timeoutUs = dueUs;
+    m_sinkWait.store(kSinkIdle, std::memory_order_relaxed);
+    HeavyBarrier();
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        for (size_t i = 0; i < m_threadBuffersVec.size(); ++i) {
+            if (m_threadBuffersVec[i]->getUsedSize() != 0) {
+                m_sinkWait.store(kSinkRunning, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_loggerMutex);
+        for (Logger* logger : m_loggers) {
+            if (logger->m_dropped.load(std::memory_order_relaxed) != logger->m_reportedDrops) {
+                // 丢弃报告按kDropReportInterval节流, 睡到下次报告时刻.
+                uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now().time_since_epoch())
+                                   .count();
+                uint64_t next = m_lastDropReport + kDropReportInterval;
+                uint64_t due  = (next > now ? next - now : 1) * 1000;
+                timeoutUs     = timeoutUs == 0 ? due : std::min(timeoutUs, due);
+                break;
+            }
+        }
+    }
+    if (!isSyncPending()) {
+        FutexWait(&m_sinkWait, kSinkIdle,
+                  static_cast<uint32_t>(std::min<uint64_t>(timeoutUs, UINT32_MAX)));
+    }
+
+    if (policy.mode == WakeupPolicy::BATCH && policy.interval != 0) {
+        m_sinkWait.store(kSinkBatching, std::memory_order_relaxed);
+        if (!isSyncPending()) {
+            FutexWait(&m_sinkWait, kSinkBatching, policy.interval);
+        }
+    }
+    m_sinkWait.store(kSinkRunning, std::memory_order_relaxed);
+}
+
+bool LogBackend::reclaimThreadBuffer(size_t idx) {
+    SegmentedBuffer::ptr& buffer = m_threadBuffersVec[idx];
+    // 先确认线程已退出, 再确认读空.
+    if (!buffer->isRetired() || buffer->getUsedSize() != 0) {
+        return false;
+    }
+    // 有序输出暂存的记录还引用线程上下文.
+    if (!m_reorderQueues.empty()) {
+        m_reorderQueues.resize(m_threadBuffersVec.size());
+        if (m_reorderQueues[idx].records.size() != 0) {
+            return false;
+        }
+    }
+
+    size_t last = m_threadBuffersVec.size() - 1;
+    std::swap(m_threadBuffersVec[idx], m_threadBuffersVec[last]);
+    std::swap(m_threadContextsVec[idx], m_threadContextsVec[last]);
+    m_threadBuffersVec.pop_back();
+    m_threadContextsVec.pop_back();
+    if (!m_reorderQueues.empty()) {
+        // fmt::memory_buffer不允许移动赋值给自己.
+        if (idx != last) {
+            std::swap(m_reorderQueues[idx], m_reorderQueues[last]);
+        }
+        m_reorderQueues.pop_back();
+    }
+    return true;
+}
+
+bool LogBackend::renderDropReport() {
+    uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+    if (now - m_lastDropReport < kDropReportInterval) {
+        return false;
+    }
+    m_lastDropReport = now;
+
+    static constexpr LogCallSite callSite{"hilog.h", __LINE__, "sinkThread", LogLevel::WARN,
+                                          nullptr,   0};
+    bool                         rendered = false;
+    std::lock_guard<std::mutex>  lock(m_loggerMutex);
+    for (Logger* logger : m_loggers) {
+        uint64_t dropped = logger->m_dropped.load(std::memory_order_relaxed);
+        if (dropped == logger->m_reportedDrops) {
+            continue;
+        }
+        touchLogger(logger);
+        size_t offset = logger->m_renderBuffer.size();
+        m_deferredEvent.reset(&callSite, &GetThreadContext(), TscClock::Now());
+        fmt::format_to(fmt::appender(m_deferredEvent.getBuffer()),
+                       "{} log records dropped because a thread buffer was full",
+                       dropped - logger->m_reportedDrops);
+        logger->m_snapshot.load(std::memory_order_acquire)
+            ->formatter->format(logger->m_renderBuffer, LogLevel::WARN, m_deferredEvent);
+        addRenderedSpan(logger, logger->m_renderBuffer.size() - offset, LogLevel::WARN);
+        logger->m_reportedDrops = dropped;
+        rendered                = true;
+    }
+    return rendered;
+}
+
 LoggerManager::LoggerManager() {
     m_root.reset(new Logger);
     m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
@@ -5,9 +5,20 @@
 #ifndef XHONGWHEELS_LOG_APPENDER_H
 #define XHONGWHEELS_LOG_APPENDER_H
 #include "log_formatter.h"
-#include <fstream>
+#include "log_record.h"
+#include <chrono>
+#include <fcntl.h>
 #include <memory>
 #include <mutex>
+#include <vector>
+#if defined(_WIN32)
+#    include <io.h>
+#else
+#    include <cerrno>
+#    include <climits>
+#    include <sys/uio.h>
+#    include <unistd.h>
+#endif
 namespace xhong {
 /**
  * @brief 日志输出目标
@@ -18,6 +29,15 @@ class LogAppender {
   public:
     using ptr = std::shared_ptr<LogAppender>;
 
+    /**
+     * @brief 刷新策略, 三个条件任一满足即刷新, 取0或UNKNOW表示关闭对应条件
+     */
+    struct FlushPolicy {
+        uint64_t        bytes    = 0;               /// 未刷新字节数达到该值时刷新
+        uint32_t        interval = 1000;            /// 距上次刷新超过该毫秒数时刷新
+        LogLevel::Level level    = LogLevel::ERROR;  /// 不低于该级别的日志立即刷新
+    };
+
     /**
      * @brief 析构函数
      */
@@ -29,10 +49,20 @@ class LogAppender {
      * @param[in] level 日志级别
      * @param[in] event 日志事件
      */
-    virtual void log(LogLevel::Level level, LogEvent::ptr event) = 0;
+    virtual void log(LogLevel::Level level, const LogEvent& event) = 0;
 
     virtual void log(LogLevel::Level level, const std::string& data, size_t len) = 0;
 
+    /**
+     * @brief 写入后台线程交来的一批已格式化的日志
+     * @param[in] spans 文本片段, 按顺序拼接即为输出内容, 低于本日志目标级别的片段跳过;
+     *                  指向线程缓冲区, 只在调用期间有效, 调用返回后才归还给生产者
+     * @param[in] count 片段数
+     * @details 默认实现拼接不低于本日志目标级别的片段, 以其中的最高级别调用
+     *          log(level, data, len)
+     */
+    virtual void log(const LogSpan* spans, size_t count);
+
     /**
      * @brief 更改日志格式器
      */
@@ -53,11 +83,57 @@ class LogAppender {
      */
     void setLevel(LogLevel::Level level) { m_level = level; }
 
+    /**
+     * @brief 设置刷新策略
+     */
+    void setFlushPolicy(const FlushPolicy& policy);
+
+    /**
+     * @brief 获取刷新策略
+     */
+    FlushPolicy getFlushPolicy();
+
+    /**
+     * @brief 立即刷新已写入的日志
+     */
+    void flush();
+
+    /**
+     * @brief 距上次刷新超过策略间隔且有未刷新数据时刷新
+     * @details 由后台线程在空闲时调用, 避免低频日志长时间滞留在流缓冲区
+     * @return 距下次定时刷新的毫秒数, 没有未刷新数据或策略不按时间刷新时返回0
+     */
+    uint64_t flushIfDue();
+
   protected:
+    /**
+     * @brief 写入一条或一批日志后按刷新策略决定是否刷新, 调用方需持有m_mutex
+     * @param[in] level 日志级别, 批量写入时为实际写入的日志中的最高级别
+     * @param[in] bytes 本次写入的字节数
+     */
+    void afterWrite(LogLevel::Level level, size_t bytes);
+
+    /**
+     * @brief 刷新底层输出流, 调用方需持有m_mutex
+     */
+    virtual void flushLocked() = 0;
+
+    /**
+     * @brief 单调时钟的当前毫秒数
+     */
+    static uint64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
     LogLevel::Level   m_level        = LogLevel::DEBUG;  /// 日志级别
     bool              m_hasFormatter = false;            /// 是否有自己的日志格式器
     std::mutex        m_mutex;                           /// Mutex
     LogFormatter::ptr m_formatter;                       /// 日志格式器
+    FlushPolicy       m_flushPolicy;                     /// 刷新策略
+    uint64_t          m_pendingBytes  = 0;               /// 上次刷新后写入的字节数
+    uint64_t          m_lastFlushTime = NowMs();         /// 上次刷新时间(毫秒)
 };
 
 /**
@@ -67,24 +143,36 @@ class StdoutLogAppender : public LogAppender {
   public:
     using ptr =  std::shared_ptr<StdoutLogAppender>;
 
-    void log(LogLevel::Level level, LogEvent::ptr event) override;
+    void log(LogLevel::Level level, const LogEvent& event) override;
 
     void log(LogLevel::Level level, const std::string& data, size_t len) override;
+
+    void log(const LogSpan* spans, size_t count) override;
+
+  protected:
+    void flushLocked() override { std::cout.flush(); }
 };
 
 /**
  * @brief 输出到文件的Appender
+ * @details 直接写文件描述符: 后台线程交来的片段用一次writev写出, 不再拼接;
+ *          逐条写入的日志先暂存, 按刷新策略或暂存量写出
  */
 class FileLogAppender : public LogAppender {
   public:
     using ptr =  std::shared_ptr<FileLogAppender>;
 
+    static constexpr size_t kPendingLimit = 64 * 1024;  /// 暂存超过该字节数时立即写出
+
     FileLogAppender(const std::string& filename){m_filename=filename;};
 
+    ~FileLogAppender() override;
 
-    void log(LogLevel::Level level, LogEvent::ptr event) override;
+    void log(LogLevel::Level level, const LogEvent& event) override;
 
     void log(LogLevel::Level level, const std::string& data, size_t len) override;
+
+    void log(const LogSpan* spans, size_t count) override;
     // std::string toYamlString() override;
 
     /**
@@ -93,10 +181,24 @@ class FileLogAppender : public LogAppender {
      */
     bool reopen();
 
+  protected:
+    void flushLocked() override { writeLocked(nullptr, 0); }
+
   private:
-    std::string   m_filename;      /// 文件路径
-    std::ofstream m_filestream;    /// 文件流
-    uint64_t      m_lastTime = 0;  /// 上次重新打开时间
+    /**
+     * @brief 把暂存的日志与spans按顺序写入文件, 调用方需持有m_mutex
+     * @param[in] spans 文本片段, 可以为空, 低于本日志目标级别的片段跳过
+     * @param[in] count 片段数
+     */
+    void writeLocked(const LogSpan* spans, size_t count);
+
+    std::string        m_filename;      /// 文件路径
+    int                m_fd = -1;       /// 文件描述符
+    fmt::memory_buffer m_pending;       /// 逐条写入时暂存的日志
+    uint64_t           m_lastTime = 0;  /// 上次重新打开时间(秒)
+#if !defined(_WIN32)
+    std::vector<iovec> m_iov;  /// writev的参数, 复用以免每批分配
+#endif
 };
 
 /**
@@ -119,55 +221,232 @@ LogFormatter::ptr LogAppender::getFormatter() {
     return m_formatter;
 }
 
-void StdoutLogAppender::log(LogLevel::Level level, LogEvent::ptr event) {
+void LogAppender::setFlushPolicy(const FlushPolicy& policy) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_flushPolicy = policy;
+}
+
+LogAppender::FlushPolicy LogAppender::getFlushPolicy() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_flushPolicy;
+}
+
+void LogAppender::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    flushLocked();
+    m_pendingBytes  = 0;
+    m_lastFlushTime = NowMs();
+}
+
+uint64_t LogAppender::flushIfDue() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pendingBytes == 0 || m_flushPolicy.interval == 0) {
+        return 0;
+    }
+    uint64_t now = NowMs();
+    if (now - m_lastFlushTime >= m_flushPolicy.interval) {
+        flushLocked();
+        m_pendingBytes  = 0;
+        m_lastFlushTime = now;
+        return 0;
+    }
+    return m_lastFlushTime + m_flushPolicy.interval - now;
+}
+
+void LogAppender::afterWrite(LogLevel::Level level, size_t bytes) {
+    m_pendingBytes += bytes;
+    bool due = (m_flushPolicy.level != LogLevel::UNKNOW && level >= m_flushPolicy.level) ||
+               (m_flushPolicy.bytes != 0 && m_pendingBytes >= m_flushPolicy.bytes);
+    // 时间条件在写入路径上也检查, 持续写入时不依赖后台线程的空闲检查.
+    uint64_t now = 0;
+    if (!due && m_flushPolicy.interval != 0) {
+        now = NowMs();
+        due = now - m_lastFlushTime >= m_flushPolicy.interval;
+    }
+    if (due) {
+        flushLocked();
+        m_pendingBytes  = 0;
+        m_lastFlushTime = now ? now : NowMs();
+    }
+}
+
+void LogAppender::log(const LogSpan* spans, size_t count) {
+    std::string     data;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    for (size_t i = 0; i < count; ++i) {
+        if (spans[i].level >= m_level) {
+            data.append(spans[i].data, spans[i].size);
+            level = std::max(level, spans[i].level);
+        }
+    }
+    if (!data.empty()) {
+        log(level, data, data.size());
+    }
+}
+
+void StdoutLogAppender::log(LogLevel::Level level, const LogEvent& event) {
     if (level >= m_level) {
+        fmt::memory_buffer buf;
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_formatter->format(std::cout, level, event);
+        m_formatter->format(buf, level, event);
+        std::cout.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        afterWrite(level, buf.size());
     }
 }
 
 void StdoutLogAppender::log(LogLevel::Level level, const std::string& data, size_t len) {
     if (level >= m_level) {
         std::lock_guard<std::mutex> lock(m_mutex);
-        std::cout << data.substr(0, len);
+        std::cout.write(data.data(), static_cast<std::streamsize>(std::min(len, data.size())));
+        afterWrite(level, len);
     }
 }
 
-void FileLogAppender::log(LogLevel::Level level, LogEvent::ptr event) {
+void StdoutLogAppender::log(const LogSpan* spans, size_t count) {
+    size_t                      bytes = 0;
+    LogLevel::Level             level = LogLevel::UNKNOW;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < count; ++i) {
+        if (spans[i].level >= m_level) {
+            std::cout.write(spans[i].data, static_cast<std::streamsize>(spans[i].size));
+            bytes += spans[i].size;
+            level = std::max(level, spans[i].level);
+        }
+    }
+    if (bytes != 0) {
+        afterWrite(level, bytes);
+    }
+}
+
+constexpr size_t FileLogAppender::kPendingLimit;
+
+FileLogAppender::~FileLogAppender() {
+    writeLocked(nullptr, 0);
+    if (m_fd >= 0) {
+#if defined(_WIN32)
+        _close(m_fd);
+#else
+        close(m_fd);
+#endif
+    }
+}
+
+void FileLogAppender::log(LogLevel::Level level, const LogEvent& event) {
     if (level >= m_level) {
-        uint64_t now = event->getTime();
+        uint64_t now = event.getTime() / 1000000;
         if (now >= (m_lastTime + 3)) {
             reopen();
             m_lastTime = now;
         }
         std::lock_guard<std::mutex> lock(m_mutex);
-        if (!m_formatter->format(m_filestream, level, event)) {
-            std::cout << "error" << std::endl;
+        size_t                      offset = m_pending.size();
+        m_formatter->format(m_pending, level, event);
+        size_t bytes = m_pending.size() - offset;
+        if (m_pending.size() >= kPendingLimit) {
+            writeLocked(nullptr, 0);
         }
+        afterWrite(level, bytes);
     }
 }
 
 void FileLogAppender::log(LogLevel::Level level, const std::string& data, size_t len) {
-    if (level >= m_level) {
-        uint64_t now = time(0);
-        if (now >= (m_lastTime + 3)) {
-            reopen();
-            m_lastTime = now;
-        }
-        std::lock_guard<std::mutex> lock(m_mutex);
-        if (!(m_filestream << data.substr(0, len))) {
-            std::cout << "error" << std::endl;
+    LogSpan span{data.data(), std::min(len, data.size()), level};
+    log(&span, 1);
+}
+
+void FileLogAppender::log(const LogSpan* spans, size_t count) {
+    size_t          bytes = 0;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    for (size_t i = 0; i < count; ++i) {
+        if (spans[i].level >= m_level) {
+            bytes += spans[i].size;
+            level = std::max(level, spans[i].level);
         }
     }
+    if (bytes == 0) {
+        return;
+    }
+    uint64_t now = time(0);
+    if (now >= (m_lastTime + 3)) {
+        reopen();
+        m_lastTime = now;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    writeLocked(spans, count);
+    afterWrite(level, bytes);
 }
 
 bool FileLogAppender::reopen() {
     std::lock_guard<std::mutex> lock(m_mutex);
-    if (m_filestream) {
-        m_filestream.close();
+    // 暂存的日志写入旧文件.
+    writeLocked(nullptr, 0);
+#if defined(_WIN32)
+    if (m_fd >= 0) {
+        _close(m_fd);
+    }
+    m_fd = _open(m_filename.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, 0644);
+#else
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    return m_fd >= 0;
+}
+
+void FileLogAppender::writeLocked(const LogSpan* spans, size_t count) {
+    if (m_pending.size() == 0 && count == 0) {
+        return;
+    }
+    bool ok = m_fd >= 0;
+#if defined(_WIN32)
+    LogSpan pending{m_pending.data(), m_pending.size(), LogLevel::UNKNOW};
+    for (size_t i = 0; ok && i <= count; ++i) {
+        const LogSpan& span = i == 0 ? pending : spans[i - 1];
+        if (i != 0 && span.level < m_level) {
+            continue;
+        }
+        for (size_t done = 0; ok && done < span.size;) {
+            int n = _write(m_fd, span.data + done, static_cast<unsigned>(span.size - done));
+            ok    = n > 0;
+            done += ok ? n : 0;
+        }
+    }
+#else
+    m_iov.clear();
+    if (m_pending.size() != 0) {
+        m_iov.push_back(iovec{m_pending.data(), m_pending.size()});
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (spans[i].size != 0 && spans[i].level >= m_level) {
+            m_iov.push_back(iovec{const_cast<char*>(spans[i].data), spans[i].size});
+        }
+    }
+    // 一次最多IOV_MAX段; 部分写入时跳过已写完的段, 从剩余位置继续.
+    iovec* iov  = m_iov.data();
+    size_t left = m_iov.size();
+    while (ok && left > 0) {
+        ssize_t n = writev(m_fd, iov, static_cast<int>(std::min<size_t>(left, IOV_MAX)));
+        if (n < 0) {
+            ok = errno == EINTR;
+            continue;
+        }
+        size_t written = static_cast<size_t>(n);
+        while (left > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --left;
+        }
+        if (left > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+#endif
+    m_pending.clear();
+    if (!ok) {
+        std::cout << "error" << std::endl;
     }
-    m_filestream.open(m_filename, std::ios::out | std::ios::app);
-    return m_filestream.is_open();
 }
 }  // namespace xhong
 
@@ -0,0 +1,160 @@
+//
+// Created by yangxiaohong on 2021-12-14.
+//
+
+#ifndef XHONGWHEELS_LOG_CALLSITE_H
+#define XHONGWHEELS_LOG_CALLSITE_H
+#include "log_level.h"
+#include "utils.h"
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+#include <type_traits>
+
+namespace xhong {
+
+/**
+ * @brief 返回路径中的文件名部分, 可在编译期求值
+ * @param[in] path 文件路径
+ */
+constexpr const char* BaseName(const char* path) {
+    const char* base = path;
+    for (const char* p = path; *p != '\0'; ++p) {
+        if (*p == '/' || *p == '\\') {
+            base = p + 1;
+        }
+    }
+    return base;
+}
+
+/**
+ * @brief 返回字符串长度, 可在编译期求值
+ */
+constexpr uint32_t StrLength(const char* str) {
+    uint32_t len = 0;
+    while (str != nullptr && str[len] != '\0') {
+        ++len;
+    }
+    return len;
+}
+
+/**
+ * @brief 格式字符串表达式是否是字符串字面量, 按表达式的类型判断
+ * @details 字面量的类型是const char (&)[N], 具有静态存储期, 可以放进constexpr描述符,
+ *          也可以在调用返回后由后台线程读取; 指针, std::string, fmt::runtime等只在调用期间有效
+ */
+template <typename T>
+struct IsFormatLiteral : std::false_type {};
+
+template <size_t N>
+struct IsFormatLiteral<const char (&)[N]> : std::true_type {};
+
+/**
+ * @brief 返回字面量格式字符串, 可在编译期求值
+ */
+template <size_t N>
+constexpr const char* FormatLiteral(const char (&str)[N]) {
+    return str;
+}
+
+/**
+ * @brief 非字面量没有编译期的值, 只为HILOG_DEFINE_CALLSITE中不求值的分支提供类型
+ */
+template <typename T>
+constexpr const char* FormatLiteral(const T&) {
+    return nullptr;
+}
+
+/**
+ * @brief 日志调用点的静态描述符
+ * @details 每个HILOG_*宏展开时定义一个static constexpr的描述符,
+ *          日志事件与缓冲区中的记录只携带指向它的指针
+ */
+struct LogCallSite {
+    const char*     file;      /// 文件名(不含目录)
+    int32_t         line;      /// 行号
+    const char*     function;  /// 函数名
+    LogLevel::Level level;     /// 日志级别
+    const char*     fmt;       /// 格式字符串, 流式宏与非字面量格式为nullptr
+    uint32_t        fmtSize;   /// 格式字符串长度
+};
+
+/**
+ * @brief 全局日志级别代数, 任意日志器修改级别时加一
+ * @details 从1开始, 调用点缓存中的代数为0时永远视为失效
+ */
+std::atomic<uint32_t>& LogLevelGeneration() {
+    static std::atomic<uint32_t> generation{1};
+    return generation;
+}
+
+/**
+ * @brief 调用点的日志级别判断缓存
+ * @details 每个HILOG_*宏展开时定义一个静态缓存, 用一个64位原子字记录
+ *          "日志器ID | 代数 | 是否输出", 只在日志器变化或代数变化时重新判断;
+ *          原子字只有常量初始化, 不需要静态局部变量的初始化守卫
+ */
+class LogLevelCache {
+  public:
+    /**
+     * @brief 返回logger在当前调用点是否输出级别为level的日志
+     * @param[in] logger 日志器, 需提供getId()与getLevel()
+     * @param[in] level 调用点的日志级别
+     */
+    template <typename LoggerT>
+    bool isEnabled(const LoggerT& logger, LogLevel::Level level) {
+        uint64_t word = m_word.load(std::memory_order_relaxed);
+        if (XHONG_LIKELY((word >> 1) == key(logger.getId(), LogLevelGeneration().load(
+                                                                std::memory_order_relaxed)))) {
+            return (word & 1) != 0;
+        }
+        return revalidate(logger, level);
+    }
+
+  private:
+    /**
+     * @brief 组合日志器ID与代数, 代数只保留低31位
+     */
+    static uint64_t key(uint32_t logger_id, uint32_t generation) {
+        return (static_cast<uint64_t>(logger_id) << 31) | (generation & 0x7fffffffu);
+    }
+
+    /**
+     * @brief 缓存失效时重新判断并写回
+     * @details 先acquire读取代数再读取级别, 与setLevel的写入顺序配对;
+     *          即使读到旧级别, 写回的代数也已过期, 下一次调用会再次判断
+     */
+    template <typename LoggerT>
+    XHONG_COLD bool revalidate(const LoggerT& logger, LogLevel::Level level) {
+        uint32_t generation = LogLevelGeneration().load(std::memory_order_acquire);
+        bool     enabled    = logger.getLevel() <= level;
+        m_word.store((key(logger.getId(), generation) << 1) | (enabled ? 1 : 0),
+                     std::memory_order_relaxed);
+        return enabled;
+    }
+
+    std::atomic<uint64_t> m_word{0};  /// 日志器ID(32位) | 代数(31位) | 是否输出(1位)
+};
+
+}  // namespace xhong
+
+/**
+ * @brief 在当前作用域定义名为name的调用点级别缓存
+ */
+#define HILOG_DEFINE_LEVEL_CACHE(name) static xhong::LogLevelCache name
+
+/**
+ * @brief 在当前作用域定义名为name的调用点描述符
+ * @details fmt是字符串字面量时描述符记录格式字符串; 否则记为nullptr, 由写日志的冷路径
+ *          在调用时补全. 条件表达式未选中的分支不求值, 非字面量不参与常量求值
+ */
+#define HILOG_DEFINE_CALLSITE(name, level, fmt)                                                    \
+    static constexpr xhong::LogCallSite name {                                                     \
+        xhong::BaseName(__FILE__), __LINE__, __func__, level,                                      \
+            xhong::IsFormatLiteral<decltype(fmt)>::value ? xhong::FormatLiteral(fmt) : nullptr,    \
+            xhong::IsFormatLiteral<decltype(fmt)>::value                                           \
+                ? xhong::StrLength(xhong::FormatLiteral(fmt))                                      \
+                : 0                                                                                \
+    }
+
+#endif  // XHONGWHEELS_LOG_CALLSITE_H
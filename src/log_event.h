@@ -6,11 +6,15 @@
 #define XHONGWHEELS_LOG_EVENT_H
 #define FMT_HEADER_ONLY
 #include "fmt/format.h"
+#include "fmt/printf.h"
 #include "hilog.h"
+#include "log_callsite.h"
 #include "log_level.h"
+#include "tsc_clock.h"
+#include "utils.h"
 #include <iostream>
 #include <memory>
-#include <sstream>
+#include <streambuf>
 #include <stdarg.h>
 #if defined(_WIN32)
 #    include <windows.h>
@@ -18,7 +22,145 @@
 #endif
 namespace xhong {
 
+/**
+ * @brief 追加size字节到缓冲区
+ * @details 容量足够时直接memcpy, 绕开fmt::detail::buffer::append的逐段扩容循环
+ */
+inline void Append(fmt::detail::buffer<char>& out, const char* data, size_t size) {
+    size_t pos = out.size();
+    if (XHONG_UNLIKELY(pos + size > out.capacity())) {
+        out.append(data, data + size);
+        return;
+    }
+    memcpy(out.data() + pos, data, size);
+    out.try_resize(pos + size);
+}
+
+/**
+ * @brief 追加C字符串到缓冲区
+ */
+inline void Append(fmt::detail::buffer<char>& out, const char* str) {
+    Append(out, str, strlen(str));
+}
+
+/**
+ * @brief 追加整数格式化结果到缓冲区
+ */
+inline void Append(fmt::detail::buffer<char>& out, const fmt::format_int& num) {
+    Append(out, num.data(), num.size());
+}
+
 class Logger;
+
+/**
+ * @brief 直接写入fmt缓冲区的streambuf
+ * @details 把缓冲区的剩余容量作为put area, 普通写入不经过虚函数;
+ *          写入的字节数在sync()时才计入缓冲区的size
+ */
+class LogStreamBuf : public std::streambuf {
+  public:
+    /**
+     * @brief 设置输出目标缓冲区
+     */
+    void setBuffer(fmt::detail::buffer<char>* out) {
+        m_out = out;
+        resetPutArea();
+    }
+
+  protected:
+    int_type overflow(int_type ch) override {
+        commit();
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            m_out->push_back(traits_type::to_char_type(ch));
+        }
+        resetPutArea();
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        if (n <= epptr() - pptr()) {
+            memcpy(pptr(), s, n);
+            pbump(static_cast<int>(n));
+        }
+        else {
+            commit();
+            m_out->append(s, s + n);
+            resetPutArea();
+        }
+        return n;
+    }
+
+    int sync() override {
+        commit();
+        resetPutArea();
+        return 0;
+    }
+
+  private:
+    /**
+     * @brief 将put area中已写入的字节计入缓冲区
+     */
+    void commit() { m_out->try_resize(pptr() - m_out->data()); }
+
+    /**
+     * @brief 以缓冲区的剩余容量作为新的put area
+     */
+    void resetPutArea() {
+        if (m_out->capacity() == m_out->size()) {
+            m_out->try_reserve(m_out->size() + 1);
+        }
+        setp(m_out->data() + m_out->size(), m_out->data() + m_out->capacity());
+    }
+
+  private:
+    fmt::detail::buffer<char>* m_out = nullptr;  /// 输出目标缓冲区
+};
+
+/**
+ * @brief 流式宏使用的输出流, 内容直接写入日志事件的缓冲区
+ * @details 构造std::ostream需要初始化locale, 因此每个线程复用一个实例,
+ *          只有在operator<<中嵌套写日志时才临时创建新的实例
+ */
+class LogStream : public std::ostream {
+  public:
+    LogStream() : std::ostream(&m_streamBuf) {}
+
+    /**
+     * @brief 绑定到out, 并恢复默认的格式状态
+     */
+    void attach(fmt::detail::buffer<char>& out) {
+        m_streamBuf.setBuffer(&out);
+        clear();
+        flags(std::ios_base::skipws | std::ios_base::dec);
+        width(0);
+        precision(6);
+        fill(' ');
+    }
+
+    /**
+     * @brief 获取当前线程可用的输出流
+     * @param[out] owned 当前线程的输出流已被占用时, 新建的输出流由owned持有
+     */
+    static LogStream* Acquire(std::unique_ptr<LogStream>& owned) {
+        static thread_local LogStream stream;
+        if (!stream.m_busy) {
+            stream.m_busy = true;
+            return &stream;
+        }
+        owned.reset(new LogStream);
+        return owned.get();
+    }
+
+    /**
+     * @brief 归还输出流
+     */
+    void release() { m_busy = false; }
+
+  private:
+    LogStreamBuf m_streamBuf;      /// 输出目标
+    bool         m_busy = false;  /// 是否正被某个日志事件使用
+};
+
 /**
  * @brief 日志事件
  */
@@ -31,25 +173,37 @@ class LogEvent {
      */
     virtual ~LogEvent() {}
 
+    /**
+     * @brief 返回调用点描述符
+     */
+    const LogCallSite* getCallSite() const { return m_callSite; }
+
     /**
      * @brief 返回文件名
      */
-    const char* getFile() const { return m_file; }
+    const char* getFile() const { return m_callSite->file; }
 
     /**
      * @brief 返回行号
      */
-    int32_t getLine() const { return m_line; }
+    int32_t getLine() const { return m_callSite->line; }
 
     /**
-     * @brief 返回耗时
+     * @brief 返回函数名
      */
-    uint32_t getElapse() const { return m_elapse; }
+    const char* getFunction() const { return m_callSite->function; }
+
+    /**
+     * @brief 返回程序启动开始到日志产生时的毫秒数, 由时间戳换算, 不再单独读取时钟
+     */
+    uint32_t getElapse() const {
+        return static_cast<uint32_t>((getTimeNs() - TscClock::StartNanoseconds()) / 1000000);
+    }
 
     /**
      * @brief 返回线程ID
      */
-    uint32_t getThreadId() const { return m_threadId; }
+    uint32_t getThreadId() const { return m_thread->threadId; }
 
     /**
      * @brief 返回协程ID
@@ -57,41 +211,52 @@ class LogEvent {
     uint32_t getFiberId() const { return m_fiberId; }
 
     /**
-     * @brief 返回时间
+     * @brief 返回时间(微秒)
      */
-    uint64_t getTime() const { return m_time; }
+    uint64_t getTime() const { return TscClock::ToMicroseconds(m_time); }
+
+    /**
+     * @brief 返回时间(纳秒)
+     */
+    uint64_t getTimeNs() const { return TscClock::ToNanoseconds(m_time); }
+
+    /**
+     * @brief 返回时钟原始读数, 见TscClock
+     */
+    uint64_t getRawTime() const { return m_time; }
 
     /**
      * @brief 返回线程名称
      */
-    const char* getThreadName() const { return m_threadName; }
+    const char* getThreadName() const { return m_thread->threadName; }
 
     /**
      * @brief 返回日志内容
      */
     virtual std::string getContent() const = 0;
 
+    /**
+     * @brief 将日志内容追加到out
+     */
+    virtual void appendContent(fmt::detail::buffer<char>& out) const = 0;
+
     /**
      * @brief 返回日志器
      */
-    std::shared_ptr<Logger> getLogger() const { return m_logger; }
+    Logger* getLogger() const { return m_logger; }
 
     /**
      * @brief 返回日志级别
      */
-    LogLevel::Level getLevel() const { return m_level; }
+    LogLevel::Level getLevel() const { return m_callSite->level; }
 
   protected:
-    const char*             m_file       = nullptr;  /// 文件名
-    int32_t                 m_line       = 0;        /// 行号
-    uint32_t                m_elapse     = 0;        /// 程序启动开始到现在的毫秒数
-    uint32_t                m_threadId   = 0;        /// 线程ID
-    uint32_t                m_fiberId    = 0;        /// 协程ID
-    uint64_t                m_time       = 0;        /// 时间戳
-    const char*             m_threadName = nullptr;  /// 线程名称
-    char*                   m_content    = nullptr;  ///日志内容
-    std::shared_ptr<Logger> m_logger;                /// 日志器
-    LogLevel::Level         m_level;                 /// 日志等级
+    const LogCallSite*   m_callSite = nullptr;  /// 调用点描述符
+    const ThreadContext* m_thread   = nullptr;  /// 线程上下文(线程ID与名称)
+    uint32_t             m_fiberId  = 0;        /// 协程ID
+    uint64_t             m_time     = 0;        /// 时钟原始读数, 见TscClock
+    char*                m_content  = nullptr;  ///日志内容
+    Logger*              m_logger   = nullptr;  /// 日志器
 };
 
 /**
@@ -104,54 +269,104 @@ class BasicLogEvent : public LogEvent {
     /**
      * @brief 构造函数
      * @param[in] logger 日志器
-     * @param[in] level 日志级别
-     * @param[in] file 文件名
-     * @param[in] line 文件行号
-     * @param[in] elapse 程序启动依赖的耗时(毫秒)
-     * @param[in] thread_id 线程id
+     * @param[in] call_site 调用点描述符
+     * @param[in] thread 线程上下文
      * @param[in] fiber_id 协程id
-     * @param[in] time 日志事件(秒)
-     * @param[in] thread_name 线程名称
-     */
-    BasicLogEvent(std::shared_ptr<Logger> logger,
-                  LogLevel::Level         level,
-                  const char*             file,
-                  int32_t                 line,
-                  uint32_t                elapse,
-                  uint32_t                thread_id,
-                  uint32_t                fiber_id,
-                  uint64_t                time,
-                  const char*             thread_name) {
-        m_file       = file;
-        m_line       = line;
-        m_elapse     = elapse;
-        m_threadId   = thread_id;
-        m_fiberId    = fiber_id;
-        m_time       = time;
-        m_threadName = thread_name;
-        m_logger     = logger;
-        m_level      = level;
+     * @param[in] time 时钟原始读数(TscClock::Now)
+     */
+    BasicLogEvent(Logger*              logger,
+                  const LogCallSite*   call_site,
+                  const ThreadContext* thread,
+                  uint32_t             fiber_id,
+                  uint64_t             time) {
+        m_callSite = call_site;
+        m_thread   = thread;
+        m_fiberId  = fiber_id;
+        m_time     = time;
+        m_logger   = logger;
     };
+
+    /**
+     * @brief 析构函数, 归还输出流
+     */
+    ~BasicLogEvent() override {
+        if (m_stream != nullptr) {
+            m_stream->release();
+        }
+    }
+
     /**
      * @brief 返回日志内容
      */
-    std::string getContent() const override { return m_ss.str(); }
+    std::string getContent() const override {
+        syncStream();
+        return {m_buf.data(), m_buf.size()};
+    }
+
     /**
-     * @brief 返回日志内容字符串流
+     * @brief 将日志内容追加到out
      */
-    std::stringstream& getSstream() { return m_ss; }
+    void appendContent(fmt::detail::buffer<char>& out) const override {
+        syncStream();
+        Append(out, m_buf.data(), m_buf.size());
+    }
+
+    /**
+     * @brief 返回写入日志内容的输出流, 首次调用时绑定到当前线程的输出流
+     */
+    std::ostream& getSstream() {
+        if (m_stream == nullptr) {
+            m_stream = LogStream::Acquire(m_ownedStream);
+            m_stream->attach(m_buf);
+        }
+        return *m_stream;
+    }
 
     /**
      * @brief 格式化写入日志内容
      */
     void format(const char* fmt, ...);
 
+    /**
+     * @brief 按printf格式写入日志内容, 由fmt/printf.h完成, 不分配堆内存
+     * @details 参数按实际类型格式化, 格式与参数不匹配时写入错误提示而不是未定义行为
+     */
+    template <typename... Args>
+    void printfFormat(const char* fmt, const Args&... args);
+
   private:
+    /**
+     * @brief 调用writer写入日志内容
+     * @details 已绑定输出流时先写入临时缓冲区, 再经输出流追加, 保持与流式内容的顺序
+     */
+    template <typename Writer>
+    void writeContent(Writer&& writer) {
+        if (XHONG_LIKELY(m_stream == nullptr)) {
+            writer(m_buf);
+            return;
+        }
+        fmt::memory_buffer content;
+        writer(content);
+        m_stream->write(content.data(), static_cast<std::streamsize>(content.size()));
+    }
+
+    /**
+     * @brief 将输出流中尚未计入的内容写回m_buf
+     */
+    void syncStream() const {
+        if (m_stream != nullptr) {
+            m_stream->rdbuf()->pubsync();
+        }
+    }
+
     /**
      * @brief 格式化写入日志内容
      */
-    void              format(const char* fmt, va_list args);
-    std::stringstream m_ss;  /// 日志内容流
+    void format(const char* fmt, va_list args);
+
+    fmt::basic_memory_buffer<char, 1024> m_buf;                /// 日志内容
+    LogStream*                           m_stream = nullptr;  /// 绑定的输出流
+    std::unique_ptr<LogStream>           m_ownedStream;       /// 嵌套写日志时新建的输出流
 };
 
 /**
@@ -164,33 +379,21 @@ class FmtLogEvent : public LogEvent {
     /**
      * @brief 构造函数
      * @param[in] logger 日志器
-     * @param[in] level 日志级别
-     * @param[in] file 文件名
-     * @param[in] line 文件行号
-     * @param[in] elapse 程序启动依赖的耗时(毫秒)
-     * @param[in] thread_id 线程id
+     * @param[in] call_site 调用点描述符
+     * @param[in] thread 线程上下文
      * @param[in] fiber_id 协程id
-     * @param[in] time 日志事件(秒)
-     * @param[in] thread_name 线程名称
-     */
-    FmtLogEvent(std::shared_ptr<Logger> logger,
-                LogLevel::Level         level,
-                const char*             file,
-                int32_t                 line,
-                uint32_t                elapse,
-                uint32_t                thread_id,
-                uint32_t                fiber_id,
-                uint64_t                time,
-                const char*             thread_name) {
-        m_file       = file;
-        m_line       = line;
-        m_elapse     = elapse;
-        m_threadId   = thread_id;
-        m_fiberId    = fiber_id;
-        m_time       = time;
-        m_threadName = thread_name;
-        m_logger     = logger;
-        m_level      = level;
+     * @param[in] time 时钟原始读数(TscClock::Now)
+     */
+    FmtLogEvent(Logger*              logger,
+                const LogCallSite*   call_site,
+                const ThreadContext* thread,
+                uint32_t             fiber_id,
+                uint64_t             time) {
+        m_callSite = call_site;
+        m_thread   = thread;
+        m_fiberId  = fiber_id;
+        m_time     = time;
+        m_logger   = logger;
     };
 
     /**
@@ -198,6 +401,31 @@ class FmtLogEvent : public LogEvent {
      */
     std::string getContent() const override { return {buf.data(), buf.size()}; }
 
+    /**
+     * @brief 将日志内容追加到out
+     */
+    void appendContent(fmt::detail::buffer<char>& out) const override {
+        Append(out, buf.data(), buf.size());
+    }
+
+    /**
+     * @brief 返回日志内容缓冲区
+     */
+    fmt::detail::buffer<char>& getBuffer() { return buf; }
+
+    /**
+     * @brief 重置事件内容, 供后台线程复用同一个事件渲染延迟格式化记录
+     * @param[in] call_site 调用点描述符
+     * @param[in] thread 线程上下文
+     * @param[in] time 时钟原始读数(TscClock::Now)
+     */
+    void reset(const LogCallSite* call_site, const ThreadContext* thread, uint64_t time) {
+        m_callSite = call_site;
+        m_thread   = thread;
+        m_time     = time;
+        buf.clear();
+    }
+
     /**
      * @brief 现代格式化写入日志内容
      */
@@ -225,26 +453,43 @@ void BasicLogEvent::format(const char* fmt, ...) {
 
 /**
  * @brief 格式化写入日志内容
+ * @details 直接vsnprintf到缓冲区的剩余容量, 容量不足时扩容后再格式化一次.
+ *          va_list不能按值拷贝, 重试用的副本在lambda外va_copy, lambda按引用使用两者
  */
 void BasicLogEvent::format(const char* fmt, va_list args) {
-    char* buf = nullptr;
-#if defined(_WIN32)
-    int maxLen = 1024;
-    int len;
-    while (true) {
-        buf = (char*)realloc(buf, maxLen);
-        len = vsnprintf(buf, maxLen, fmt, args);
-        if (len >= 0 && len < maxLen)
-            break;
-        maxLen *= 2;
-    }
-#else
-    int len = vasprintf(&buf, fmt, args);
-#endif
-    if (len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
-    }
+    va_list retry;
+    va_copy(retry, args);
+    writeContent([&](fmt::detail::buffer<char>& out) {
+        size_t size  = out.size();
+        size_t avail = out.capacity() - size;
+        int    len   = vsnprintf(out.data() + size, avail, fmt, args);
+        if (len >= 0) {
+            if (static_cast<size_t>(len) >= avail) {
+                out.try_reserve(size + len + 1);
+                vsnprintf(out.data() + size, len + 1, fmt, retry);
+            }
+            out.try_resize(size + len);
+        }
+    });
+    va_end(retry);
+}
+
+/**
+ * @brief 按printf格式写入日志内容
+ */
+template <typename... Args>
+void BasicLogEvent::printfFormat(const char* fmt, const Args&... args) {
+    writeContent([&](fmt::detail::buffer<char>& out) {
+        size_t size = out.size();
+        try {
+            fmt::detail::vprintf(out, fmt::string_view(fmt),
+                                 fmt::printf_args(fmt::make_printf_args(args...)));
+        } catch (const fmt::format_error& e) {
+            out.try_resize(size);
+            fmt::format_to(fmt::detail::buffer_appender<char>(out), "<printf error: {}> {}",
+                           e.what(), fmt);
+        }
+    });
 }
 
 /**
@@ -9,13 +9,22 @@
 #include "log_level.h"
 #include "timestamp.h"
 #include <cstdlib>
-#include <functional>
+#include <cstring>
 #include <iostream>
 #include <list>
 #include <map>
 #include <memory>
-#include <sstream>
 #include <vector>
+
+/**
+ * @brief 定义名为name的编译期日志模板, 供StaticLogFormatter<name>使用
+ * @details pattern必须是字符串字面量, 无法识别的%xxx在编译期报错
+ */
+#define HILOG_STATIC_PATTERN(name, pattern)                                                        \
+    struct name {                                                                                  \
+        static constexpr const char* value() { return pattern; }                                   \
+    }
+
 namespace xhong {
 /**
  * @brief 日志格式化
@@ -34,7 +43,7 @@ class LogFormatter {
      *  %c 日志名称
      *  %t 线程id
      *  %n 换行
-     *  %d 时间
+     *  %d 时间, 可带格式如%d{%Y-%m-%d %H:%M:%S.%Qms}, 见TimestampFormatter
      *  %f 文件名
      *  %l 行号
      *  %T 制表符
@@ -45,38 +54,31 @@ class LogFormatter {
      */
     LogFormatter(const std::string& pattern) : m_pattern(pattern) { init(); }
 
+    /**
+     * @brief 析构函数
+     */
+    virtual ~LogFormatter() {}
+
     /**
      * @brief 返回格式化日志文本
      * @param[in] logger 日志器
      * @param[in] level 日志级别
      * @param[in] event 日志事件
      */
-    std::string format(LogLevel::Level level, LogEvent::ptr event);
+    std::string format(LogLevel::Level level, const LogEvent& event);
 
-    std::ostream& format(std::ostream& ofs, LogLevel::Level level, LogEvent::ptr event);
+    std::ostream& format(std::ostream& ofs, LogLevel::Level level, const LogEvent& event);
 
-  public:
     /**
-     * @brief 日志内容项格式化
+     * @brief 将格式化日志文本追加到out, 不分配堆内存
+     * @param[in, out] out 输出缓冲区
+     * @param[in] level 日志级别
+     * @param[in] event 日志事件
+     * @details 编译期模板的StaticLogFormatter覆盖该函数
      */
-    class FormatItem {
-      public:
-        using ptr = std::shared_ptr<FormatItem>;
-
-        /**
-         * @brief 析构函数
-         */
-        virtual ~FormatItem() {}
-
-        /**
-         * @brief 格式化日志到流
-         * @param[in, out] os 日志输出流
-         * @param[in] logger 日志器
-         * @param[in] level 日志等级
-         * @param[in] event 日志事件
-         */
-        virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) = 0;
-    };
+    virtual void format(fmt::detail::buffer<char>& out,
+                        LogLevel::Level            level,
+                        const LogEvent&            event);
 
     /**
      * @brief 初始化,解析日志模板
@@ -93,141 +95,342 @@ class LogFormatter {
      */
     const std::string getPattern() const { return m_pattern; }
 
-  private:
-    std::string                  m_pattern;        /// 日志格式模板
-    std::vector<FormatItem::ptr> m_formatters;     /// 日志格式解析后格式
-    bool                         m_error = false;  /// 是否有错误
-};
+    /**
+     * @brief 格式化指令
+     */
+    enum OpCode : uint8_t {
+        LITERAL,      /// 常量文本, 取m_literals[offset, offset + length)
+        MESSAGE,      /// %m 消息
+        LEVEL,        /// %p 日志级别
+        ELAPSE,       /// %r 累计毫秒数
+        THREAD_ID,    /// %t 线程id
+        DATETIME,     /// %d 时间, 取m_dateTimes[offset]
+        FILENAME,     /// %f 文件名
+        LINE,         /// %l 行号
+        FIBER_ID,     /// %F 协程id
+        THREAD_NAME,  /// %N 线程名称
+    };
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-  public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
+    /**
+     * @brief 将事件中code对应的字段追加到out, code不能是LITERAL或DATETIME
+     * @details code为常量时, 内联后只保留对应分支
+     */
+    static void formatField(OpCode                     code,
+                            fmt::detail::buffer<char>& out,
+                            LogLevel::Level            level,
+                            const LogEvent&            event) {
+        switch (code) {
+            case MESSAGE: event.appendContent(out); break;
+            case LEVEL: Append(out, LogLevel::toString(level)); break;
+            case ELAPSE: Append(out, fmt::format_int(event.getElapse())); break;
+            case THREAD_ID: Append(out, fmt::format_int(event.getThreadId())); break;
+            case FILENAME: Append(out, event.getFile()); break;
+            case LINE: Append(out, fmt::format_int(event.getLine())); break;
+            case FIBER_ID: Append(out, fmt::format_int(event.getFiberId())); break;
+            case THREAD_NAME: Append(out, event.getThreadName()); break;
+            default: break;
+        }
     }
-};
 
-class LevelFormatItem : public LogFormatter::FormatItem {
-  public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::toString(level);
-    }
-};
+  private:
+    /**
+     * @brief 一条格式化指令, 相邻的常量文本(包括%T, %n)合并为一条LITERAL
+     */
+    struct Op {
+        OpCode   code;    /// 指令
+        uint32_t offset;  /// LITERAL在m_literals中的起始位置
+        uint32_t length;  /// LITERAL的长度
+    };
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-  public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }
-};
+    /**
+     * @brief 追加一段常量文本, 与前一条LITERAL相邻时直接合并
+     */
+    void appendLiteral(const std::string& str);
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-  public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
-    }
-};
+    static const uint32_t kLiteralPadding = 16;  /// m_literals末尾的填充字节数
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-  public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
-    }
+    std::string                     m_pattern;        /// 日志格式模板
+    std::vector<Op>                 m_program;        /// 模板编译后的指令序列
+    std::string                     m_literals;       /// 全部常量文本
+    std::vector<TimestampFormatter> m_dateTimes;      /// 各%d的时间格式
+    bool                            m_error = false;  /// 是否有错误
 };
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-  public:
-    ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadName();
+/**
+ * @brief 按时间格式追加时间到缓冲区
+ * @param[in, out] out 输出缓冲区
+ * @param[in] formatter 时间格式
+ * @param[in] ns 自1970年以来的纳秒数
+ */
+inline void Append(fmt::detail::buffer<char>& out,
+                   const TimestampFormatter&  formatter,
+                   uint64_t                   ns) {
+    size_t pos = out.size();
+    out.try_reserve(pos + TimestampFormatter::kMaxLength);
+    if (XHONG_LIKELY(out.capacity() >= pos + TimestampFormatter::kMaxLength)) {
+        out.try_resize(pos + formatter.format(out.data() + pos, ns));
     }
+    else {
+        char     text[TimestampFormatter::kMaxLength];
+        uint32_t length = formatter.format(text, ns);
+        out.append(text, text + length);
+    }
+}
+
+/**
+ * @brief 编译期模板解析出的一个片段
+ */
+struct PatternToken {
+    int      code;    /// LogFormatter::OpCode, 或下面的PatternToken::TAB等
+    uint32_t begin;   /// LITERAL或{...}中的格式在模板中的起始位置
+    uint32_t length;  /// LITERAL或{...}中的格式的长度
+    uint32_t next;    /// 下一个片段的起始位置
+
+    static constexpr int TAB     = -1;  /// %T
+    static constexpr int NEWLINE = -2;  /// %n
+    static constexpr int INVALID = -3;  /// 无法识别的%xxx或未闭合的{
 };
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-  public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S") : m_format(format) {
-        if (m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
+/**
+ * @brief 返回%后的格式字符对应的指令, 与LogFormatter::init中的sOpCodes一致
+ */
+constexpr int PatternOpCode(char c) {
+    return c == 'm'   ? LogFormatter::MESSAGE
+           : c == 'p' ? LogFormatter::LEVEL
+           : c == 'r' ? LogFormatter::ELAPSE
+           : c == 't' ? LogFormatter::THREAD_ID
+           : c == 'n' ? PatternToken::NEWLINE
+           : c == 'd' ? LogFormatter::DATETIME
+           : c == 'f' ? LogFormatter::FILENAME
+           : c == 'l' ? LogFormatter::LINE
+           : c == 'T' ? PatternToken::TAB
+           : c == 'F' ? LogFormatter::FIBER_ID
+           : c == 'N' ? LogFormatter::THREAD_NAME
+                      : PatternToken::INVALID;
+}
+
+/**
+ * @brief 编译期解析pattern中从pos开始的一个片段
+ * @details 规则与LogFormatter::init一致: %%为字面量%, %x{...}中的内容被忽略
+ */
+constexpr PatternToken NextPatternToken(const char* pattern, uint32_t pos) {
+    if (pattern[pos] != '%') {
+        uint32_t end = pos;
+        while (pattern[end] != '\0' && pattern[end] != '%') {
+            ++end;
         }
+        return {LogFormatter::LITERAL, pos, end - pos, end};
+    }
+    if (pattern[pos + 1] == '%') {
+        return {LogFormatter::LITERAL, pos + 1, 1, pos + 2};
     }
+    uint32_t end = pos + 1;
+    while ((pattern[end] >= 'a' && pattern[end] <= 'z') ||
+           (pattern[end] >= 'A' && pattern[end] <= 'Z')) {
+        ++end;
+    }
+    int      code  = end == pos + 2 ? PatternOpCode(pattern[pos + 1]) : PatternToken::INVALID;
+    uint32_t begin = end;
+    if (pattern[end] == '{') {
+        begin = ++end;
+        while (pattern[end] != '\0' && pattern[end] != '}') {
+            ++end;
+        }
+        if (pattern[end] == '\0') {
+            return {PatternToken::INVALID, pos, 0, end};
+        }
+        return {code, begin, end - begin, end + 1};
+    }
+    return {code, begin, 0, end};
+}
 
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        auto buf = xhong::Timestamp::TimestampAccFmtToStr(event->getTime());
-        os << buf;
+/**
+ * @brief 编译期模板的片段类型列表
+ */
+template <typename... Items>
+struct PatternItems {};
+
+/**
+ * @brief 常量文本片段, 长度为编译期常量, 追加时展开为定长拷贝
+ */
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternLiteralItem {
+    static void format(fmt::detail::buffer<char>& out, LogLevel::Level, const LogEvent&) {
+        Append(out, Pattern::value() + Begin, Length);
     }
+};
 
-  private:
-    std::string m_format;
+/**
+ * @brief %T与%n的常量文本
+ */
+struct PatternTabText {
+    static constexpr const char* value() { return "  "; }  //两个空格代替
+};
+struct PatternNewLineText {
+    static constexpr const char* value() { return "\n"; }
 };
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
-  public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
+/**
+ * @brief 字段片段
+ */
+template <int Code>
+struct PatternFieldItem {
+    static void format(fmt::detail::buffer<char>& out,
+                       LogLevel::Level            level,
+                       const LogEvent&            event) {
+        LogFormatter::formatField(static_cast<LogFormatter::OpCode>(Code), out, level, event);
     }
 };
 
-class LineFormatItem : public LogFormatter::FormatItem {
-  public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
+/**
+ * @brief 时间片段, 时间格式取自模板中%d{...}的内容
+ */
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternDateTimeItem {
+    static void format(fmt::detail::buffer<char>& out, LogLevel::Level, const LogEvent& event) {
+        static const TimestampFormatter formatter(std::string(Pattern::value() + Begin, Length));
+        Append(out, formatter, event.getTimeNs());
     }
 };
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
-  public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
-    }
+/**
+ * @brief 片段对应的类型
+ */
+template <typename Pattern, int Code, uint32_t Begin, uint32_t Length>
+struct PatternItem {
+    static_assert(Code != PatternToken::INVALID, "invalid log pattern");
+    using type = PatternFieldItem<Code>;
+};
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternItem<Pattern, LogFormatter::LITERAL, Begin, Length> {
+    using type = PatternLiteralItem<Pattern, Begin, Length>;
+};
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternItem<Pattern, LogFormatter::DATETIME, Begin, Length> {
+    using type = PatternDateTimeItem<Pattern, Begin, Length>;
+};
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternItem<Pattern, PatternToken::TAB, Begin, Length> {
+    using type = PatternLiteralItem<PatternTabText, 0, 2>;
+};
+template <typename Pattern, uint32_t Begin, uint32_t Length>
+struct PatternItem<Pattern, PatternToken::NEWLINE, Begin, Length> {
+    using type = PatternLiteralItem<PatternNewLineText, 0, 1>;
 };
 
-class StringFormatItem : public LogFormatter::FormatItem {
-  public:
-    StringFormatItem(const std::string& str) : m_string(str) {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
-    }
+/**
+ * @brief 从Pos开始逐个解析片段, 结果追加到Items
+ */
+template <typename Pattern,
+          uint32_t Pos,
+          typename Items,
+          bool Done = Pattern::value()[Pos] == '\0'>
+struct ParsePattern;
+
+template <typename Pattern, uint32_t Pos, typename... Items>
+struct ParsePattern<Pattern, Pos, PatternItems<Items...>, true> {
+    using type = PatternItems<Items...>;
+};
 
-  private:
-    std::string m_string;
+template <typename Pattern, uint32_t Pos, typename... Items>
+struct ParsePattern<Pattern, Pos, PatternItems<Items...>, false> {
+    static constexpr PatternToken token = NextPatternToken(Pattern::value(), Pos);
+    using item = typename PatternItem<Pattern, token.code, token.begin, token.length>::type;
+    using type = typename ParsePattern<Pattern, token.next, PatternItems<Items..., item>>::type;
 };
 
-class TabFormatItem : public LogFormatter::FormatItem {
+/**
+ * @brief 编译期解析模板的日志格式器
+ * @details Pattern由HILOG_STATIC_PATTERN定义, 模板在编译期展开成片段类型列表,
+ *          格式化时依次内联调用各片段, 没有循环与分支跳转;
+ *          可以通过Logger::setFormatter等接口替代运行期的LogFormatter
+ */
+template <typename Pattern>
+class StaticLogFormatter : public LogFormatter {
   public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "  ";  //两个空格代替
+    using ptr   = std::shared_ptr<StaticLogFormatter>;
+    using Items = typename ParsePattern<Pattern, 0, PatternItems<>>::type;
+
+    StaticLogFormatter() : LogFormatter(Pattern::value()) {}
+
+    using LogFormatter::format;
+
+    void format(fmt::detail::buffer<char>& out,
+                LogLevel::Level            level,
+                const LogEvent&            event) override {
+        format(Items(), out, level, event);
     }
 
   private:
-    std::string m_string;
+    template <typename... Item>
+    static void format(PatternItems<Item...>,
+                       fmt::detail::buffer<char>& out,
+                       LogLevel::Level            level,
+                       const LogEvent&            event) {
+        int expand[] = {0, (Item::format(out, level, event), 0)...};
+        (void)expand;
+    }
 };
 
+/**
+ * @brief 日志器的默认模板
+ */
+HILOG_STATIC_PATTERN(DefaultLogPattern, "%d{%Y-%m-%d %H:%M:%S.%Qus}%T%t%T[%p]%T%f:%l%T%m%n");
+
 /**
  * =============================================================================
  * =============================================================================
  */
-std::string LogFormatter::format(LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
+std::string LogFormatter::format(LogLevel::Level level, const LogEvent& event) {
+    fmt::memory_buffer buf;
+    format(buf, level, event);
+    return fmt::to_string(buf);
+}
+
+std::ostream& LogFormatter::format(std::ostream&   ofs,
+                                   LogLevel::Level level,
+                                   const LogEvent& event) {
+    fmt::memory_buffer buf;
+    format(buf, level, event);
+    return ofs.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+}
 
-    for (auto& i : m_formatters) {
-        i->format(ss, level, event);
+void LogFormatter::format(fmt::detail::buffer<char>& out,
+                          LogLevel::Level            level,
+                          const LogEvent&            event) {
+    const char* literals = m_literals.data();
+    for (const Op& op : m_program) {
+        switch (op.code) {
+            case LITERAL:
+                // 常量文本后至少有kLiteralPadding字节可读, 短文本按定长拷贝.
+                if (XHONG_LIKELY(op.length <= kLiteralPadding &&
+                                 out.size() + kLiteralPadding <= out.capacity())) {
+                    memcpy(out.data() + out.size(), literals + op.offset, kLiteralPadding);
+                    out.try_resize(out.size() + op.length);
+                }
+                else {
+                    Append(out, literals + op.offset, op.length);
+                }
+                break;
+            case DATETIME: Append(out, m_dateTimes[op.offset], event.getTimeNs()); break;
+            default: formatField(op.code, out, level, event); break;
+        }
     }
-    return ss.str();
 }
 
-std::ostream& LogFormatter::format(std::ostream& ofs, LogLevel::Level level, LogEvent::ptr event) {
-    for (auto& i : m_formatters) {
-        i->format(ofs, level, event);
+void LogFormatter::appendLiteral(const std::string& str) {
+    if (str.empty()) {
+        return;
+    }
+    uint32_t offset = static_cast<uint32_t>(m_literals.size());
+    m_literals.append(str);
+    if (!m_program.empty() && m_program.back().code == LITERAL &&
+        m_program.back().offset + m_program.back().length == offset) {
+        m_program.back().length += static_cast<uint32_t>(str.size());
+    }
+    else {
+        m_program.push_back(Op{LITERAL, offset, static_cast<uint32_t>(str.size())});
     }
-    return ofs;
 }
 
 //%xxx %xxx{xxx} %%
@@ -306,48 +509,47 @@ void LogFormatter::init() {
     if (!nStr.empty()) {
         vec.push_back(std::make_tuple(nStr, "", 0));
     }
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)>>
-        sFormatItems = {
-#define SHADOW(str, C)                                                                             \
-    {                                                                                              \
-#        str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt)); }                   \
-    }
-
-            SHADOW(m, MessageFormatItem),  // m:消息
-            SHADOW(p, LevelFormatItem),    // p:日志级别
-            SHADOW(r, ElapseFormatItem),   // r:累计毫秒数
-            // SHADOW(c, NameFormatItem),        // c:日志名称
-            SHADOW(t, ThreadIdFormatItem),    // t:线程id
-            SHADOW(n, NewLineFormatItem),     // n:换行
-            SHADOW(d, DateTimeFormatItem),    // d:时间
-            SHADOW(f, FilenameFormatItem),    // f:文件名
-            SHADOW(l, LineFormatItem),        // l:行号
-            SHADOW(T, TabFormatItem),         // T:Tab
-            SHADOW(F, FiberIdFormatItem),     // F:协程id
-            SHADOW(N, ThreadNameFormatItem),  // N:线程名称
-#undef SHADOW
-        };
+    // 值为-1的项编译为常量文本.
+    static const std::map<std::string, std::pair<int, const char*>> sOpCodes = {
+        {"m", {MESSAGE, nullptr}},      // m:消息
+        {"p", {LEVEL, nullptr}},        // p:日志级别
+        {"r", {ELAPSE, nullptr}},       // r:累计毫秒数
+        {"t", {THREAD_ID, nullptr}},    // t:线程id
+        {"n", {-1, "\n"}},             // n:换行
+        {"d", {DATETIME, nullptr}},     // d:时间
+        {"f", {FILENAME, nullptr}},     // f:文件名
+        {"l", {LINE, nullptr}},         // l:行号
+        {"T", {-1, "  "}},              // T:Tab, 两个空格代替
+        {"F", {FIBER_ID, nullptr}},     // F:协程id
+        {"N", {THREAD_NAME, nullptr}},  // N:线程名称
+    };
 
+    m_program.clear();
+    m_literals.clear();
+    m_dateTimes.clear();
     for (auto& i : vec) {
         if (std::get<2>(i) == 0) {
-            m_formatters.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            appendLiteral(std::get<0>(i));
+            continue;
+        }
+        auto iter = sOpCodes.find(std::get<0>(i));
+        if (iter == sOpCodes.end()) {
+            appendLiteral("<<error_format %" + std::get<0>(i) + ">>");
+            m_error = true;
+        }
+        else if (iter->second.first < 0) {
+            appendLiteral(iter->second.second);
+        }
+        else if (iter->second.first == DATETIME) {
+            m_program.push_back(Op{DATETIME, static_cast<uint32_t>(m_dateTimes.size()), 0});
+            m_dateTimes.emplace_back(std::get<1>(i));
         }
         else {
-            auto iter = sFormatItems.find(std::get<0>(i));
-            if (iter == sFormatItems.end()) {
-                m_formatters.push_back(FormatItem::ptr(
-                    new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-                m_error = true;
-            }
-            else {
-                m_formatters.push_back(iter->second(std::get<1>(i)));
-            }
+            m_program.push_back(Op{static_cast<OpCode>(iter->second.first), 0, 0});
         }
-
-        // std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" <<
-        //  std::get<2>(i) << ")" << std::endl;
     }
-    // std::cout <<  m_formatters.size() << std::endl;
+    // 末尾填充, 供短常量文本按定长拷贝.
+    m_literals.append(kLiteralPadding, '\0');
 }
 
 }  // namespace xhong
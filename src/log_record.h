@@ -0,0 +1,252 @@
+//
+// Created by yangxiaohong on 2021-12-13.
+//
+
+#ifndef XHONGWHEELS_LOG_RECORD_H
+#define XHONGWHEELS_LOG_RECORD_H
+#define FMT_HEADER_ONLY
+#include "fmt/format.h"
+#include "log_callsite.h"
+#include "utils.h"
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace xhong {
+class Logger;
+
+/**
+ * @brief 线程缓冲区中每条记录的公共头部
+ * @details 记录起始位置按kAlignment对齐, 下一条记录从Align(size)处开始;
+ *          记录内部的读写一律通过memcpy, 不要求对齐
+ */
+struct LogRecordHeader {
+    /**
+     * @brief 记录类型
+     */
+    enum Kind : uint16_t {
+        // 已经在调用线程上完成格式化的日志文本
+        TEXT = 0,
+        // 只保存原始参数, 由后台线程完成格式化
+        DEFERRED = 1,
+        // 环形缓冲区末尾放不下整条记录时的填充, 直接跳过
+        PADDING = 2
+    };
+
+    /**
+     * @brief 记录起始位置的对齐字节数, 保证缓冲区末尾的剩余空间总能容纳填充记录的头部
+     */
+    static constexpr uint32_t kAlignment = 8;
+
+    /**
+     * @brief 返回长度为size的记录实际占用的字节数
+     */
+    static uint32_t Align(uint32_t size) { return (size + kAlignment - 1) & ~(kAlignment - 1); }
+
+    uint32_t size;   /// 记录总长度(含头部)
+    uint16_t kind;   /// 记录类型
+    uint16_t level;  /// 日志级别(LogLevel::Level), 供日志目标的刷新策略使用
+};
+
+constexpr uint32_t LogRecordHeader::kAlignment;
+static_assert(sizeof(LogRecordHeader) <= LogRecordHeader::kAlignment,
+              "padding record header must fit in the alignment gap");
+
+/**
+ * @brief 除填充记录外每条记录的头部, 在公共头部之后加上记录的产生时间与所属日志器
+ * @details 有序输出时后台线程按time归并各线程的记录; 各日志器共用线程缓冲区,
+ *          后台线程按logger把记录交给对应日志器的格式器与日志目标.
+ *          填充记录只有公共头部, 因此公共头部仍能放进缓冲区末尾的对齐间隙
+ */
+struct TimedRecordHeader {
+    LogRecordHeader header;  /// 公共头部
+    uint64_t        time;    /// 时钟原始读数, 由后台线程换算成墙上时间
+    Logger*         logger;  /// 所属日志器, 注销前后台线程会输出它的全部记录
+};
+
+/**
+ * @brief 一段连续的日志字节, 指向线程缓冲区或后台线程的渲染缓冲区, 不持有内存
+ * @details 交给日志目标的片段只包含同一级别的日志, 日志目标据此逐段过滤
+ */
+struct LogSpan {
+    const char*     data;   /// 起始地址
+    size_t          size;   /// 字节数
+    LogLevel::Level level;  /// 片段中日志的级别, 认领线程缓冲区空间时不使用
+};
+
+/**
+ * @brief 延迟格式化记录的解码函数
+ * @param[in] args 参数区起始地址
+ * @param[in] fmt 格式字符串
+ * @param[out] out 格式化结果
+ */
+using DeferredDecoder = void (*)(const char*                args,
+                                 fmt::string_view           fmt,
+                                 fmt::detail::buffer<char>& out);
+
+/**
+ * @brief 延迟格式化记录头部, 紧跟在TimedRecordHeader之后, 其后是原始参数字节
+ */
+struct DeferredRecordHeader {
+    DeferredDecoder      decoder;   /// 与调用点参数类型对应的解码函数
+    const LogCallSite*   callSite;  /// 调用点描述符, 其中包含格式字符串
+    const ThreadContext* thread;    /// 线程上下文, 由日志器保持有效
+};
+
+/**
+ * @brief 单个参数的序列化方式, 默认不支持延迟格式化
+ */
+template <typename T, typename Enable = void>
+struct DeferredArg {
+    static constexpr bool supported = false;
+};
+
+/**
+ * @brief 算术类型与void指针: 直接拷贝原始字节
+ */
+template <typename T>
+struct DeferredArg<T,
+                   typename std::enable_if<std::is_arithmetic<T>::value ||
+                                           std::is_same<T, const void*>::value ||
+                                           std::is_same<T, void*>::value>::type> {
+    static constexpr bool supported = true;
+    using stored                    = T;
+
+    static size_t size(const T&) { return sizeof(T); }
+
+    static char* encode(char* p, const T& v) {
+        memcpy(p, &v, sizeof(T));
+        return p + sizeof(T);
+    }
+
+    static const char* decode(const char* p, stored& v) {
+        memcpy(&v, p, sizeof(T));
+        return p + sizeof(T);
+    }
+};
+
+/**
+ * @brief 字符串: 长度+字节, 解码时直接引用记录中的字节
+ * @details 空指针只写入长度标记kNull, 解码时像fmt一样报告"string pointer is null"
+ */
+template <typename T>
+struct DeferredArg<T,
+                   typename std::enable_if<std::is_same<T, const char*>::value ||
+                                           std::is_same<T, char*>::value ||
+                                           std::is_same<T, std::string>::value ||
+                                           std::is_same<T, fmt::string_view>::value>::type> {
+    static constexpr bool     supported = true;
+    static constexpr uint32_t kNull     = UINT32_MAX;
+    using stored                        = fmt::string_view;
+
+    static size_t size(const T& v) {
+        return sizeof(uint32_t) + (IsNull(v) ? 0 : fmt::string_view(v).size());
+    }
+
+    static char* encode(char* p, const T& v) {
+        uint32_t len = kNull;
+        if (IsNull(v)) {
+            memcpy(p, &len, sizeof(len));
+            return p + sizeof(len);
+        }
+        fmt::string_view str(v);
+        len = static_cast<uint32_t>(str.size());
+        memcpy(p, &len, sizeof(len));
+        memcpy(p + sizeof(len), str.data(), len);
+        return p + sizeof(len) + len;
+    }
+
+    static const char* decode(const char* p, stored& v) {
+        uint32_t len = 0;
+        memcpy(&len, p, sizeof(len));
+        if (len == kNull) {
+            FMT_THROW(fmt::format_error("string pointer is null"));
+        }
+        v = fmt::string_view(p + sizeof(len), len);
+        return p + sizeof(len) + len;
+    }
+
+  private:
+    static bool IsNull(const char* v) { return v == nullptr; }
+    static bool IsNull(const std::string&) { return false; }
+    static bool IsNull(fmt::string_view) { return false; }
+};
+
+/**
+ * @brief 一组参数能否全部延迟格式化
+ */
+template <typename... Args>
+struct DeferredArgs;
+
+template <>
+struct DeferredArgs<> {
+    static constexpr bool supported = true;
+};
+
+template <typename T, typename... Rest>
+struct DeferredArgs<T, Rest...> {
+    static constexpr bool supported =
+        DeferredArg<typename std::decay<T>::type>::supported && DeferredArgs<Rest...>::supported;
+};
+
+/**
+ * @brief 延迟格式化参数的编解码
+ */
+template <typename... Args>
+class DeferredCodec {
+  public:
+    /**
+     * @brief 返回参数序列化后的字节数
+     */
+    static size_t size(const Args&... args) {
+        size_t total   = 0;
+        int    dummy[] = {0, (total += DeferredArg<Args>::size(args), 0)...};
+        (void)dummy;
+        return total;
+    }
+
+    /**
+     * @brief 按顺序序列化参数, 返回写入结束位置
+     */
+    static char* encode(char* p, const Args&... args) {
+        int dummy[] = {0, (p = DeferredArg<Args>::encode(p, args), 0)...};
+        (void)dummy;
+        return p;
+    }
+
+    /**
+     * @brief 还原参数并完成格式化, 签名与DeferredDecoder一致
+     * @details 在后台线程执行, 格式与参数不匹配时写入错误提示而不是抛出异常
+     */
+    static void decode(const char* p, fmt::string_view fmt, fmt::detail::buffer<char>& out) {
+        size_t size = out.size();
+        try {
+            decode(p, fmt, out, std::index_sequence_for<Args...>());
+        } catch (const fmt::format_error& e) {
+            out.try_resize(size);
+            fmt::format_to(fmt::detail::buffer_appender<char>(out), "<format error: {}> {}",
+                           e.what(), fmt);
+        }
+    }
+
+  private:
+    template <size_t... I>
+    static void decode(const char*                p,
+                       fmt::string_view           fmt,
+                       fmt::detail::buffer<char>& out,
+                       std::index_sequence<I...>) {
+        std::tuple<typename DeferredArg<Args>::stored...> values;
+
+        int dummy[] = {0, (p = DeferredArg<Args>::decode(p, std::get<I>(values)), 0)...};
+        (void)dummy;
+        (void)p;
+        fmt::detail::vformat_to(out, fmt, fmt::make_format_args(std::get<I>(values)...));
+    }
+};
+
+}  // namespace xhong
+
+#endif  // XHONGWHEELS_LOG_RECORD_H
@@ -4,9 +4,14 @@
 
 #ifndef XHONGWHEELS_TIMESTAMP_H
 #define XHONGWHEELS_TIMESTAMP_H
+#include "utils.h"
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #ifdef __linux
 #    include <sys/time.h>
@@ -18,6 +23,63 @@
 
 namespace xhong {
 
+/**
+ * @brief 时区换算
+ * @details 每个线程缓存一段UTC偏移不变的时间窗口, 窗口内的换算是纯算术运算;
+ *          只有时间落在窗口外(跨过夏令时切换点或窗口到期, 窗口最长一天)时才调用localtime_r
+ */
+class TimeZone {
+  public:
+    /**
+     * @brief 将自1970年以来的秒数换算成本地时间
+     */
+    static void ToLocal(int64_t second, struct tm& tm);
+
+    /**
+     * @brief 将自1970年以来的秒数换算成UTC时间
+     */
+    static void ToUtc(int64_t second, struct tm& tm);
+
+    /**
+     * @brief 返回second时刻本地时间相对UTC的偏移秒数
+     */
+    static long OffsetSeconds(int64_t second) { return Lookup(second).offset; }
+
+  private:
+    /**
+     * @brief UTC偏移不变的时间窗口[from, until)
+     */
+    struct Window {
+        int64_t     from   = 1;        /// 起始秒数(含)
+        int64_t     until  = 0;        /// 结束秒数(不含)
+        long        offset = 0;        /// UTC偏移秒数
+        int         isdst  = 0;        /// 是否夏令时
+        const char* zone   = nullptr;  /// 时区缩写
+    };
+
+    static const int64_t kWindowSpan = 24 * 3600;  /// 单侧最大搜索范围
+
+    /**
+     * @brief 返回包含second的窗口, 必要时重新计算
+     */
+    static const Window& Lookup(int64_t second);
+
+    /**
+     * @brief 调用localtime_r读取second时刻的偏移
+     */
+    static void Probe(int64_t second, Window& window);
+
+    /**
+     * @brief 在(same, changed]中二分查找偏移变化后的第一秒
+     */
+    static int64_t FindTransition(int64_t same, int64_t changed, const Window& window);
+
+    /**
+     * @brief 纯算术换算UTC时间, 见Howard Hinnant的civil_from_days
+     */
+    static void CivilFromSeconds(int64_t second, struct tm& tm);
+};
+
 // Wrapper of timestamp.
 class Timestamp {
   public:
@@ -30,6 +92,8 @@ class Timestamp {
     static Timestamp   ParseFmtToTimestampObj(const std::string& fmt);
     static std::string TimestampFmtToStr(uint64_t time, const std::string& fmt);
     static std::string TimestampAccFmtToStr(uint64_t time, const std::string& fmt);
+    static const char* TimestampFmtToCStr(uint64_t time, const char* fmt);
+    static const char* TimestampAccFmtToCStr(uint64_t time, const char* fmt);
 
     uint64_t    GetTimestamp() const { return m_timestamp; }
     int         GetYear() const { return ToTm().tm_year + 1900; }
@@ -41,12 +105,88 @@ class Timestamp {
     int64_t     Compare(const Timestamp& t) const;
     std::string Format(const std::string& format) const;
     std::string AccurateFormat(const std::string& format) const;
+    std::string ToIso8601(bool utc) const;  // e.g. 2020-07-09T06:48:36.458074Z
+    struct tm   ToTm() const;               // Convert to local 'struct tm', all fields at once
+    struct tm   ToUtcTm() const;            // Convert to UTC 'struct tm'
 
   private:
-    struct tm             ToTm() const;  // Convert to 'struct tm'
     uint64_t              m_timestamp;
     static const uint32_t m_uSecPerSec = 1000 * 1000;
 };
+
+/**
+ * @brief 按格式渲染纳秒时间戳
+ * @details 格式为strftime格式, 另外支持秒以下的%Qms(3位毫秒), %Qus(6位微秒), %Qns(9位纳秒);
+ *          以'!'开头时按UTC输出, 否则按本地时间输出.
+ *          秒以上的部分每个线程每秒只用strftime渲染一次并缓存, 秒以下的部分用两位数字表
+ *          直接写入输出, 不分配也不返回std::string
+ */
+class TimestampFormatter {
+  public:
+    static constexpr const char* kDefaultFormat = "%Y-%m-%d %H:%M:%S.%Qus";  /// 默认格式
+    static constexpr const char* kIso8601Local  = "%Y-%m-%dT%H:%M:%S.%Qus%z";  /// ISO-8601本地时间
+    static constexpr const char* kIso8601Utc    = "!%Y-%m-%dT%H:%M:%S.%QusZ";  /// ISO-8601 UTC
+    static const uint32_t        kMaxLength     = 128;  /// 输出的最大长度, 超出部分被截断
+
+    /**
+     * @brief 构造函数
+     * @param[in] format 时间格式, 为空时使用kDefaultFormat
+     */
+    explicit TimestampFormatter(const std::string& format = kDefaultFormat);
+
+    /**
+     * @brief 将ns渲染到dst
+     * @param[out] dst 输出地址, 至少有kMaxLength字节可写
+     * @param[in] ns 自1970年以来的纳秒数
+     * @return 写入的字节数
+     */
+    uint32_t format(char* dst, uint64_t ns) const;
+
+    /**
+     * @brief 返回时间格式
+     */
+    const std::string& getFormat() const { return m_format; }
+
+  private:
+    static const uint32_t kMaxFractions = 4;  /// 最多缓存的秒以下字段数
+    static const uint32_t kCacheSlots   = 8;  /// 每个线程的缓存槽数
+
+    /**
+     * @brief 已渲染文本中的一个秒以下字段
+     */
+    struct Fraction {
+        uint16_t offset;  /// 在文本中的位置
+        uint8_t  digits;  /// 位数, 3/6/9
+    };
+
+    /**
+     * @brief 一个格式在某一秒的渲染结果, 秒以下字段先以0占位
+     */
+    struct Cache {
+        uint32_t owner         = 0;   /// 所属格式器ID, 0表示空
+        int64_t  second        = -1;  /// 渲染时的秒数
+        uint32_t length        = 0;   /// 文本长度
+        uint32_t fractionCount = 0;   /// 秒以下字段数
+        Fraction fractions[kMaxFractions];  /// 秒以下字段
+        char     text[kMaxLength];          /// 渲染结果
+    };
+
+    /**
+     * @brief 渲染second对应的文本到cache
+     */
+    void render(int64_t second, Cache& cache) const;
+
+    /**
+     * @brief 将value以digits位十进制(左侧补0)写入dst
+     */
+    static void WriteDigits(char* dst, uint32_t value, uint32_t digits);
+
+    std::string              m_format;    /// 时间格式
+    std::vector<std::string> m_segments;  /// 以秒以下字段分隔的strftime格式, 比m_digits多一个
+    std::vector<uint8_t>     m_digits;    /// 各秒以下字段的位数
+    bool                     m_utc;       /// 是否按UTC输出
+    uint32_t                 m_id;        /// 格式器ID, 用于选择线程缓存槽
+};
 /**
  * =============================================================================
  * =============================================================================
@@ -93,31 +233,42 @@ Timestamp Timestamp::ParseFmtToTimestampObj(const std::string& fmt) {
 
 std::string Timestamp::TimestampFmtToStr(uint64_t           time,
                                          const std::string& format = "%Y-%m-%d-%H:%M:%S") {
+    return TimestampFmtToCStr(time, format.c_str());
+}
+
+std::string Timestamp::TimestampAccFmtToStr(uint64_t           time,
+                                            const std::string& format = "%Y-%m-%d-%H:%M:%S") {
+    return TimestampAccFmtToCStr(time, format.c_str());
+}
+
+// Same as TimestampFmtToStr, but returns the thread local buffer to avoid allocation.
+const char* Timestamp::TimestampFmtToCStr(uint64_t time, const char* format = "%Y-%m-%d-%H:%M:%S") {
     static thread_local time_t sec = 0;
     static thread_local char   datetime[32];  // 2019-08-16-15:32:25
     time_t                     nowSec = time / m_uSecPerSec;
     if (sec != nowSec) {
         sec = nowSec;
         struct tm tm;
-        localtime_r(&sec, &tm);
-        strftime(datetime, sizeof(datetime), format.c_str(), &tm);
+        TimeZone::ToLocal(sec, tm);
+        strftime(datetime, sizeof(datetime), format, &tm);
     }
     return datetime;
 }
 
-std::string Timestamp::TimestampAccFmtToStr(uint64_t           time,
-                                            const std::string& format = "%Y-%m-%d-%H:%M:%S") {
+// Same as TimestampAccFmtToStr, but returns the thread local buffer to avoid allocation.
+const char* Timestamp::TimestampAccFmtToCStr(uint64_t    time,
+                                             const char* format = "%Y-%m-%d-%H:%M:%S") {
     static thread_local uint64_t lastTime = 0;
     static thread_local char     buf[64];
     if (lastTime == time) {
         return buf;
     }
-    lastTime          = time;
-    auto     datetime = TimestampFmtToStr(time);
-    uint32_t micro    = static_cast<uint32_t>(time % m_uSecPerSec);
-    uint32_t ms       = static_cast<uint32_t>(micro / 1000);
-    uint32_t us       = static_cast<uint32_t>(micro % 1000);
-    snprintf(buf, sizeof(buf), "%s.%03u.%03u", datetime.c_str(), ms, us);
+    lastTime             = time;
+    const char* datetime = TimestampFmtToCStr(time, format);
+    uint32_t    micro    = static_cast<uint32_t>(time % m_uSecPerSec);
+    uint32_t    ms       = static_cast<uint32_t>(micro / 1000);
+    uint32_t    us       = static_cast<uint32_t>(micro % 1000);
+    snprintf(buf, sizeof(buf), "%s.%03u.%03u", datetime, ms, us);
 
     return buf;
 }
@@ -132,7 +283,7 @@ std::string Timestamp::Format(const std::string& format = "%Y-%m-%d-%H:%M:%S") c
     if (sec != nowSec) {
         sec = nowSec;
         struct tm tm;
-        localtime_r(&sec, &tm);
+        TimeZone::ToLocal(sec, tm);
         strftime(datetime, sizeof(datetime), format.c_str(), &tm);
     }
     return datetime;
@@ -159,14 +310,236 @@ int64_t Timestamp::Compare(const Timestamp& t) const {
     return static_cast<int64_t>(m_timestamp - t.GetTimestamp());
 }
 
+std::string Timestamp::ToIso8601(bool utc = true) const {
+    TimestampFormatter formatter(utc ? TimestampFormatter::kIso8601Utc
+                                     : TimestampFormatter::kIso8601Local);
+    char               buf[TimestampFormatter::kMaxLength];
+    return std::string(buf, formatter.format(buf, m_timestamp * 1000));
+}
+
 struct tm Timestamp::ToTm() const
 {
-    time_t    nowSec = m_timestamp / m_uSecPerSec;
     struct tm tm;
-    localtime_r(&nowSec, &tm);
+    TimeZone::ToLocal(static_cast<int64_t>(m_timestamp / m_uSecPerSec), tm);
+    return tm;
+}
+
+struct tm Timestamp::ToUtcTm() const
+{
+    struct tm tm;
+    TimeZone::ToUtc(static_cast<int64_t>(m_timestamp / m_uSecPerSec), tm);
     return tm;
 }
 
+void TimeZone::ToLocal(int64_t second, struct tm& tm) {
+    const Window& window = Lookup(second);
+    CivilFromSeconds(second + window.offset, tm);
+    tm.tm_isdst  = window.isdst;
+    tm.tm_gmtoff = window.offset;
+    tm.tm_zone   = window.zone;
+}
+
+void TimeZone::ToUtc(int64_t second, struct tm& tm) {
+    CivilFromSeconds(second, tm);
+    tm.tm_isdst  = 0;
+    tm.tm_gmtoff = 0;
+    tm.tm_zone   = "UTC";
+}
+
+const TimeZone::Window& TimeZone::Lookup(int64_t second) {
+    static thread_local Window window;
+    if (XHONG_LIKELY(second >= window.from && second < window.until)) {
+        return window;
+    }
+
+    Probe(second, window);
+    // 向两侧各探测一天, 偏移不同则二分查找切换点; 否则窗口在一天后到期.
+    Window probe;
+    Probe(second + kWindowSpan, probe);
+    window.until = probe.offset == window.offset && probe.isdst == window.isdst
+                       ? second + kWindowSpan
+                       : FindTransition(second, second + kWindowSpan, window);
+    Probe(second - kWindowSpan, probe);
+    window.from = probe.offset == window.offset && probe.isdst == window.isdst
+                      ? second - kWindowSpan
+                      : FindTransition(second, second - kWindowSpan, window) + 1;
+    return window;
+}
+
+void TimeZone::Probe(int64_t second, Window& window) {
+    time_t    t = static_cast<time_t>(second);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    window.offset = tm.tm_gmtoff;
+    window.isdst  = tm.tm_isdst;
+    window.zone   = tm.tm_zone;
+}
+
+int64_t TimeZone::FindTransition(int64_t same, int64_t changed, const Window& window) {
+    // 向前查找时same > changed, 结果为偏移仍不同的最后一秒.
+    Window probe;
+    while (same - changed > 1 || changed - same > 1) {
+        int64_t mid = same + (changed - same) / 2;
+        Probe(mid, probe);
+        if (probe.offset == window.offset && probe.isdst == window.isdst) {
+            same = mid;
+        }
+        else {
+            changed = mid;
+        }
+    }
+    return changed;
+}
+
+void TimeZone::CivilFromSeconds(int64_t second, struct tm& tm) {
+    int64_t days = second / 86400;
+    int64_t rem  = second % 86400;
+    if (rem < 0) {
+        rem += 86400;
+        --days;
+    }
+    tm.tm_hour = static_cast<int>(rem / 3600);
+    tm.tm_min  = static_cast<int>(rem % 3600 / 60);
+    tm.tm_sec  = static_cast<int>(rem % 60);
+    tm.tm_wday = static_cast<int>((days % 7 + 11) % 7);  // 1970-01-01为星期四
+
+    int64_t  z   = days + 719468;
+    int64_t  era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t doe = static_cast<uint32_t>(z - era * 146097);                 // [0, 146096]
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;  // [0, 399]
+    int64_t  y   = static_cast<int64_t>(yoe) + era * 400;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);  // 自3月1日起
+    uint32_t mp  = (5 * doy + 2) / 153;                      // 3月为0
+    uint32_t d   = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t m   = mp < 10 ? mp + 3 : mp - 9;
+    if (m <= 2) {
+        ++y;
+    }
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+
+    tm.tm_year = static_cast<int>(y - 1900);
+    tm.tm_mon  = static_cast<int>(m - 1);
+    tm.tm_mday = static_cast<int>(d);
+    tm.tm_yday = static_cast<int>(mp < 10 ? doy + 59 + (leap ? 1 : 0) : doy - 306);
+}
+
+constexpr const char* TimestampFormatter::kDefaultFormat;
+constexpr const char* TimestampFormatter::kIso8601Local;
+constexpr const char* TimestampFormatter::kIso8601Utc;
+
+TimestampFormatter::TimestampFormatter(const std::string& format)
+    : m_format(format.empty() ? kDefaultFormat : format), m_utc(false) {
+    static std::atomic<uint32_t> nextId{1};
+    m_id = nextId.fetch_add(1, std::memory_order_relaxed);
+
+    std::string segment;
+    size_t      begin = 0;
+    if (m_format[0] == '!') {
+        m_utc = true;
+        begin = 1;
+    }
+    for (size_t i = begin; i < m_format.size(); ++i) {
+        if (m_format[i] == '%' && i + 1 < m_format.size() && m_format[i + 1] == '%') {
+            segment.append("%%");
+            ++i;
+            continue;
+        }
+        uint8_t digits = 0;
+        if (m_format.compare(i, 4, "%Qms") == 0) {
+            digits = 3;
+        }
+        else if (m_format.compare(i, 4, "%Qus") == 0) {
+            digits = 6;
+        }
+        else if (m_format.compare(i, 4, "%Qns") == 0) {
+            digits = 9;
+        }
+        if (digits == 0 || m_digits.size() == kMaxFractions) {
+            segment.append(1, m_format[i]);
+            continue;
+        }
+        m_segments.push_back(segment);
+        m_digits.push_back(digits);
+        segment.clear();
+        i += 3;
+    }
+    m_segments.push_back(segment);
+}
+
+uint32_t TimestampFormatter::format(char* dst, uint64_t ns) const {
+    static thread_local Cache caches[kCacheSlots];
+    int64_t                   second = static_cast<int64_t>(ns / 1000000000ull);
+    Cache&                    cache  = caches[m_id % kCacheSlots];
+    if (cache.owner != m_id || cache.second != second) {
+        render(second, cache);
+        cache.owner  = m_id;
+        cache.second = second;
+    }
+
+    memcpy(dst, cache.text, cache.length);
+    uint32_t subsecond = static_cast<uint32_t>(ns % 1000000000ull);
+    for (uint32_t i = 0; i < cache.fractionCount; ++i) {
+        const Fraction& fraction = cache.fractions[i];
+        uint32_t        value    = fraction.digits == 3   ? subsecond / 1000000
+                                   : fraction.digits == 6 ? subsecond / 1000
+                                                          : subsecond;
+        WriteDigits(dst + fraction.offset, value, fraction.digits);
+    }
+    return cache.length;
+}
+
+void TimestampFormatter::render(int64_t second, Cache& cache) const {
+    struct tm tm;
+    if (m_utc) {
+        TimeZone::ToUtc(second, tm);
+    }
+    else {
+        TimeZone::ToLocal(second, tm);
+    }
+
+    cache.length        = 0;
+    cache.fractionCount = 0;
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+        if (!m_segments[i].empty()) {
+            // strftime在空间不足时返回0, 此时丢弃该段及之后的内容.
+            size_t n = strftime(cache.text + cache.length, kMaxLength - cache.length,
+                                m_segments[i].c_str(), &tm);
+            if (n == 0) {
+                return;
+            }
+            cache.length += static_cast<uint32_t>(n);
+        }
+        if (i < m_digits.size()) {
+            if (cache.length + m_digits[i] > kMaxLength) {
+                return;
+            }
+            cache.fractions[cache.fractionCount++] = {static_cast<uint16_t>(cache.length),
+                                                      m_digits[i]};
+            memset(cache.text + cache.length, '0', m_digits[i]);
+            cache.length += m_digits[i];
+        }
+    }
+}
+
+void TimestampFormatter::WriteDigits(char* dst, uint32_t value, uint32_t digits) {
+    static const char kDigitPairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char* p = dst + digits;
+    while (digits >= 2) {
+        p -= 2;
+        memcpy(p, kDigitPairs + (value % 100) * 2, 2);
+        value /= 100;
+        digits -= 2;
+    }
+    if (digits != 0) {
+        *--p = static_cast<char>('0' + value % 10);
+    }
+}
+
 }  // namespace xhong
 
 #endif  // XHONGWHEELS_TIMESTAMP_H
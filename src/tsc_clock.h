@@ -0,0 +1,257 @@
+//
+// Created by yangxiaohong on 2021-12-16.
+//
+
+#ifndef XHONGWHEELS_TSC_CLOCK_H
+#define XHONGWHEELS_TSC_CLOCK_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    include <cpuid.h>
+#    include <x86intrin.h>
+#    define XHONG_HAS_RDTSC 1
+#else
+#    define XHONG_HAS_RDTSC 0
+#endif
+
+namespace xhong {
+
+/**
+ * @brief 日志时钟
+ * @details 默认通过clock_gettime读取墙上时间(纳秒); 调用Enable()且CPU支持invariant TSC时,
+ *          热路径只执行一次rdtsc, 返回的原始读数带TSC标记位, 由后台线程定期校准的参数
+ *          在格式化时(通常在日志后台线程)换算成墙上时间. 两种读数可以混合存在,
+ *          因此运行期开关TSC不会影响已经写入缓冲区的记录.
+ *          TSC频率对照CLOCK_MONOTONIC测量, 墙上时间的跳变只影响每次校准时重新采样的
+ *          realtime偏移, 不会污染频率.
+ */
+class TscClock {
+  public:
+    /**
+     * @brief 返回当前时钟原始读数, 用ToNanoseconds换算
+     */
+    static uint64_t Now() {
+#if XHONG_HAS_RDTSC
+        if (Instance().m_enabled.load(std::memory_order_relaxed)) {
+            return __rdtsc() | kTscFlag;
+        }
+#endif
+        return RealtimeNs();
+    }
+
+    /**
+     * @brief 将原始读数换算成自1970年以来的纳秒数
+     */
+    static uint64_t ToNanoseconds(uint64_t raw) {
+        if (!(raw & kTscFlag)) {
+            return raw;
+        }
+        return Instance().tscToNs(raw & ~kTscFlag);
+    }
+
+    /**
+     * @brief 将原始读数换算成自1970年以来的微秒数
+     */
+    static uint64_t ToMicroseconds(uint64_t raw) { return ToNanoseconds(raw) / 1000; }
+
+    /**
+     * @brief 返回进程启动(首次使用时钟)时的纳秒数
+     */
+    static uint64_t StartNanoseconds() { return Instance().m_startNs; }
+
+    /**
+     * @brief CPU是否支持invariant TSC
+     */
+    static bool IsInvariantTscSupported() {
+#if XHONG_HAS_RDTSC
+        unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief 启用TSC时钟并启动后台校准线程
+     * @param[in] interval 校准间隔
+     * @return CPU不支持invariant TSC时返回false, 继续使用clock_gettime
+     */
+    static bool Enable(std::chrono::milliseconds interval = std::chrono::milliseconds(1000)) {
+        return Instance().enable(interval);
+    }
+
+    /**
+     * @brief 停止使用TSC时钟, 已产生的TSC读数仍按最近一次校准换算
+     */
+    static void Disable() { Instance().m_enabled.store(false, std::memory_order_relaxed); }
+
+    /**
+     * @brief 是否正在使用TSC时钟
+     */
+    static bool IsEnabled() { return Instance().m_enabled.load(std::memory_order_relaxed); }
+
+  private:
+    static constexpr uint64_t kTscFlag = 1ull << 63;  // TSC读数的标记位
+
+    TscClock() : m_startNs(RealtimeNs()) {}
+
+    /**
+     * @brief 返回进程内唯一的时钟, 与日志后台一样不析构
+     * @details 静态析构期间其他线程仍可能写日志, 日志后台也仍在换算时间,
+     *          校准线程随进程退出
+     */
+    static TscClock& Instance() {
+        static TscClock* clock = new TscClock;
+        return *clock;
+    }
+
+    static uint64_t RealtimeNs() {
+#ifdef __linux
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    static uint64_t MonotonicNs() {
+#ifdef __linux
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    static uint64_t Rdtsc() {
+#if XHONG_HAS_RDTSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    /**
+     * @brief 同时读取TSC, 单调时间与墙上时间, 取耗时最短的一次以减小误差
+     * @param[out] offset 墙上时间减单调时间, 墙上时间被向回调整时可能变小
+     */
+    static void Sample(uint64_t& tsc, uint64_t& ns, int64_t& offset) {
+        uint64_t best = UINT64_MAX;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t begin    = Rdtsc();
+            uint64_t now      = MonotonicNs();
+            uint64_t realtime = RealtimeNs();
+            uint64_t end      = Rdtsc();
+            if (end - begin < best) {
+                best   = end - begin;
+                tsc    = begin + (end - begin) / 2;
+                ns     = now;
+                offset = static_cast<int64_t>(realtime - now);
+            }
+        }
+    }
+
+    bool enable(std::chrono::milliseconds interval) {
+        if (!IsInvariantTscSupported()) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_thread.joinable()) {
+            // 先做一次10ms的短校准, 保证启用后立即可以换算.
+            int64_t offset = 0;
+            Sample(m_baseTsc, m_baseNs, offset);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            calibrate();
+            m_interval = interval;
+            m_thread   = std::thread(&TscClock::calibrateThread, this);
+        }
+        m_enabled.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 以首次采样为基准对照单调时间重新计算斜率, 以最新采样为锚点发布换算参数,
+     *        同时重新采样realtime偏移
+     */
+    void calibrate() {
+        uint64_t tsc = 0, ns = 0;
+        int64_t  offset = 0;
+        Sample(tsc, ns, offset);
+        if (tsc <= m_baseTsc || ns <= m_baseNs) {
+            return;
+        }
+        double nsPerTick =
+            static_cast<double>(ns - m_baseNs) / static_cast<double>(tsc - m_baseTsc);
+
+        // seqlock: 序号为奇数时读端重试.
+        uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_anchorTsc.store(tsc, std::memory_order_relaxed);
+        m_anchorNs.store(ns, std::memory_order_relaxed);
+        m_nsPerTick.store(nsPerTick, std::memory_order_relaxed);
+        m_realtimeOffset.store(offset, std::memory_order_relaxed);
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    void calibrateThread() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_cond.wait_for(lock, m_interval);
+            calibrate();
+        }
+    }
+
+    uint64_t tscToNs(uint64_t tsc) const {
+        uint64_t anchorTsc = 0, anchorNs = 0;
+        double   nsPerTick = 0;
+        int64_t  offset    = 0;
+        uint32_t seq       = 0;
+        do {
+            seq       = m_seq.load(std::memory_order_acquire);
+            anchorTsc = m_anchorTsc.load(std::memory_order_relaxed);
+            anchorNs  = m_anchorNs.load(std::memory_order_relaxed);
+            nsPerTick = m_nsPerTick.load(std::memory_order_relaxed);
+            offset    = m_realtimeOffset.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+
+        int64_t delta = static_cast<int64_t>(tsc - anchorTsc);
+        return anchorNs + static_cast<int64_t>(static_cast<double>(delta) * nsPerTick) + offset;
+    }
+
+    std::atomic<bool>     m_enabled{false};  // 热路径是否读取TSC
+    std::atomic<uint32_t> m_seq{0};          // 换算参数的seqlock序号
+    std::atomic<uint64_t> m_anchorTsc{0};       // 换算锚点的TSC读数
+    std::atomic<uint64_t> m_anchorNs{0};        // 换算锚点的单调时间
+    std::atomic<double>   m_nsPerTick{1.0};     // 每个TSC周期的纳秒数
+    std::atomic<int64_t>  m_realtimeOffset{0};  // 锚点处墙上时间减单调时间
+
+    uint64_t m_startNs{0};  // 进程启动时间
+    uint64_t m_baseTsc{0};  // 首次采样的TSC读数
+    uint64_t m_baseNs{0};   // 首次采样的单调时间
+
+    std::chrono::milliseconds m_interval{1000};
+    std::mutex                m_mutex;
+    std::condition_variable   m_cond;
+    std::thread               m_thread;
+};
+
+}  // namespace xhong
+
+#endif  // XHONGWHEELS_TSC_CLOCK_H
@@ -7,20 +7,194 @@
 #if defined(_WIN32)
 #    include <windows.h>
 #else
+#    include <pthread.h>
 #    include <sys/syscall.h>
 #    include <unistd.h>  // for syscall()
 #endif
+#if defined(__linux__)
+#    include <linux/futex.h>
+#    include <linux/membarrier.h>
+#    include <time.h>
+#endif
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
 #include <stdint.h>
+#include <thread>
+
+#if defined(__GNUC__) || defined(__clang__)
+#    define XHONG_LIKELY(x) __builtin_expect(!!(x), 1)
+#    define XHONG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#    define XHONG_COLD __attribute__((noinline, cold))
+#else
+#    define XHONG_LIKELY(x) (x)
+#    define XHONG_UNLIKELY(x) (x)
+#    define XHONG_COLD __declspec(noinline)
+#endif
+
 namespace xhong {
+/**
+ * @brief 线程上下文, 每个线程首次使用时填充一次
+ */
+struct ThreadContext {
+    using ptr = std::shared_ptr<ThreadContext>;
+
+    uint32_t threadId;        /// 线程ID
+    char     threadName[32];  /// 线程名称
+};
+
+/**
+ * @brief 返回当前线程的上下文
+ * @details 上下文由shared_ptr持有, 日志器可以在线程退出后继续引用其中的线程名称
+ */
+const ThreadContext::ptr& GetThreadContextPtr() {
+    static thread_local ThreadContext::ptr context = [] {
+        ThreadContext::ptr ctx(new ThreadContext());
+#if defined(_WIN32)
+        ctx->threadId = GetCurrentThreadId();
+        snprintf(ctx->threadName, sizeof(ctx->threadName), "%u", ctx->threadId);
+#else
+        ctx->threadId = static_cast<uint32_t>(syscall(SYS_gettid));
+        // pthread_getname_np要求缓冲区至少16字节.
+        if (pthread_getname_np(pthread_self(), ctx->threadName, sizeof(ctx->threadName)) != 0) {
+            snprintf(ctx->threadName, sizeof(ctx->threadName), "%u", ctx->threadId);
+        }
+#endif
+        return ctx;
+    }();
+    return context;
+}
+
+/**
+ * @brief 返回当前线程的上下文
+ * @details 快速路径只读取一个平凡的thread_local指针
+ */
+ThreadContext& GetThreadContext() {
+    static thread_local ThreadContext* context = nullptr;
+    if (context == nullptr) {
+        context = GetThreadContextPtr().get();
+    }
+    return *context;
+}
+
 /**
  * @brief 返回当前线程的ID
  */
 uint32_t GetThreadId() {
-#if defined(_WIN32)
-    return GetCurrentThreadId();
+    return GetThreadContext().threadId;
+}
+
+/**
+ * @brief 返回当前线程的名称
+ */
+const char* GetThreadName() {
+    return GetThreadContext().threadName;
+}
+
+/**
+ * @brief 设置当前线程的名称, 应在线程开始写日志之前调用
+ * @param[in] name 线程名称, 超过31字节的部分被截断
+ */
+void SetThreadName(const char* name) {
+    ThreadContext& context = GetThreadContext();
+    snprintf(context.threadName, sizeof(context.threadName), "%s", name);
+#if !defined(_WIN32)
+    // 内核中的线程名称最长15字节.
+    char kernelName[16];
+    snprintf(kernelName, sizeof(kernelName), "%s", name);
+    pthread_setname_np(pthread_self(), kernelName);
+#endif
+}
+
+/**
+ * @brief 自旋等待时提示CPU降低功耗并让出流水线
+ */
+void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief 当*addr等于expected时挂起当前线程, 直到被FutexWake唤醒或超时
+ * @param[in] addr 等待的地址
+ * @param[in] expected 期望值, 不相等时立即返回
+ * @param[in] timeoutUs 超时时间(微秒), 0表示不设超时
+ * @details 非Linux平台退化为短暂睡眠, 不设超时时睡眠1毫秒
+ */
+void FutexWait(std::atomic<uint32_t>* addr, uint32_t expected, uint32_t timeoutUs) {
+#if defined(__linux__)
+    struct timespec timeout;
+    timeout.tv_sec  = timeoutUs / 1000000;
+    timeout.tv_nsec = (timeoutUs % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE, expected,
+            timeoutUs != 0 ? &timeout : nullptr, nullptr, 0);
+#else
+    if (addr->load(std::memory_order_acquire) == expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(timeoutUs != 0 ? timeoutUs : 1000));
+    }
+#endif
+}
+
+/**
+ * @brief 唤醒在addr上等待的线程
+ * @param[in] addr 等待的地址
+ * @param[in] count 最多唤醒的线程数
+ */
+void FutexWake(std::atomic<uint32_t>* addr, int count) {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, count, nullptr,
+            nullptr, 0);
 #else
-    return syscall(SYS_gettid);
+    (void)addr;
+    (void)count;
+#endif
+}
+
+/**
+ * @brief 是否支持非对称内存屏障, 首次调用时向内核注册
+ * @details 依赖Linux 4.14起提供的MEMBARRIER_CMD_PRIVATE_EXPEDITED
+ */
+bool AsymmetricBarrierSupported() {
+#if defined(__linux__) && defined(SYS_membarrier)
+    static const bool supported =
+        syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+    return supported;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief 非对称屏障的轻量一端, 放在频繁执行的路径上
+ * @details 与HeavyBarrier配对时等价于两边各一次seq_cst屏障. 支持非对称屏障时
+ *          只阻止编译器重排, 不支持时退化为seq_cst屏障
+ */
+void LightBarrier() {
+    if (XHONG_LIKELY(AsymmetricBarrierSupported())) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+/**
+ * @brief 非对称屏障的重量一端, 放在很少执行的路径上
+ * @details 令进程内所有正在运行的线程各执行一次完整的内存屏障, 代价是一次系统调用
+ */
+void HeavyBarrier() {
+#if defined(__linux__) && defined(SYS_membarrier)
+    if (AsymmetricBarrierSupported()) {
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+        return;
+    }
 #endif
+    std::atomic_thread_fence(std::memory_order_seq_cst);
 }
 }  // namespace xhong
 
@@ -0,0 +1,137 @@
+//
+// Allocation test: a log call in steady state must not touch the heap.
+//
+
+#include "hilog.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+// 只统计开启了统计的线程, 后台线程的分配不计入.
+thread_local bool     t_counting = false;
+thread_local uint64_t t_allocs   = 0;
+
+void* CountedAlloc(size_t size) {
+    if (t_counting) {
+        ++t_allocs;
+    }
+    void* p = malloc(size != 0 ? size : 1);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+}  // namespace
+
+void* operator new(size_t size) {
+    return CountedAlloc(size);
+}
+
+void* operator new[](size_t size) {
+    return CountedAlloc(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return CountedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return CountedAlloc(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+/**
+ * @brief 丢弃全部输出的日志目标
+ */
+class NullLogAppender : public xhong::LogAppender {
+  public:
+    void log(xhong::LogLevel::Level, const xhong::LogEvent&) override {}
+
+    void log(xhong::LogLevel::Level, const std::string&, size_t) override {}
+
+    void log(const xhong::LogSpan*, size_t) override {}
+
+  protected:
+    void flushLocked() override {}
+};
+
+static xhong::Logger::ptr logger;
+
+// 每轮的写入量远小于一个分段, 每轮之后等后台线程读空, 线程缓冲区不需要新分段.
+static const int kRounds        = 20;
+static const int kCallsPerRound = 50;
+
+/**
+ * @brief 统计调用log kRounds * kCallsPerRound次期间当前线程的堆分配次数
+ */
+template <typename Fn>
+uint64_t countAllocs(Fn&& log) {
+    uint64_t total = 0;
+    for (int round = 0; round < kRounds; ++round) {
+        t_allocs   = 0;
+        t_counting = true;
+        for (int i = 0; i < kCallsPerRound; ++i) {
+            log(i);
+        }
+        t_counting = false;
+        total += t_allocs;
+        xhong::LogBackend::Instance().sync();
+    }
+    return total;
+}
+
+/**
+ * @brief 预热后统计一种写法的分配次数, 不为0时打印并返回false
+ */
+template <typename Fn>
+bool expectNoAllocs(const char* name, Fn&& log) {
+    // 首次调用会创建线程上下文, 线程缓冲区与输出流等线程局部对象.
+    countAllocs(log);
+    uint64_t allocs = countAllocs(log);
+    fmt::print("{}: {} allocations in {} calls\n", name, allocs, kRounds * kCallsPerRound);
+    return allocs == 0;
+}
+
+int main() {
+    logger.reset(new xhong::Logger("alloc_test"));
+    logger->addAppender(xhong::LogAppender::ptr(new NullLogAppender));
+
+    bool ok = true;
+    ok &= expectNoAllocs("HILOG_FMT_DEBUG", [](int i) {
+        HILOG_FMT_DEBUG(logger, "printf %d %s %.3f", i, "abc", 1.5);
+    });
+    ok &= expectNoAllocs("HILOGD", [](int i) { HILOGD(logger, "modern {} {} {}", i, "abc", 1.5); });
+    ok &= expectNoAllocs("HILOG_DEBUG", [](int i) {
+        HILOG_DEBUG(logger) << "stream " << i << " abc " << 1.5;
+    });
+
+    logger->setDeferred(true);
+    ok &= expectNoAllocs("HILOGD deferred",
+                         [](int i) { HILOGD(logger, "deferred {} {} {}", i, "abc", 1.5); });
+
+    logger.reset();
+    return ok ? 0 : 1;
+}
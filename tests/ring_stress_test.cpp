@@ -0,0 +1,199 @@
+//
+// Ring stress test: one producer and one consumer hammer a small CircleBlockingBuffer.
+// Build with -DHILOG_TSAN=ON to run it under ThreadSanitizer.
+//
+
+#include "blockingbuffer.h"
+#include <chrono>
+#include <fmt/format.h>
+
+using xhong::BackpressurePolicy;
+using xhong::CircleBlockingBuffer;
+using xhong::LogRecordHeader;
+using xhong::LogSpan;
+
+namespace {
+
+const uint32_t kCapacity  = 4096;    /// 容量很小, 几乎每轮都会绕回并写入填充记录
+const uint64_t kRecords   = 200000;  /// 每种策略写入的记录数
+const uint32_t kMaxExtra  = 300;     /// 记录负载的最大附加长度
+const uint32_t kFixedSize = sizeof(LogRecordHeader) + sizeof(uint64_t);
+
+/**
+ * @brief 序号为seq的记录长度, 各种长度混合, 使末尾剩余空间不断变化
+ */
+uint32_t RecordSize(uint64_t seq) {
+    return kFixedSize + static_cast<uint32_t>((seq * 7919) % kMaxExtra);
+}
+
+/**
+ * @brief 负载第i个字节的内容
+ */
+char PayloadByte(uint64_t seq, uint32_t i) {
+    return static_cast<char>(seq * 31 + i);
+}
+
+/**
+ * @brief 一轮测试的结果
+ */
+struct Result {
+    uint64_t received = 0;  /// 消费者读到的记录数
+    uint64_t skipped  = 0;  /// DROP_NEWEST下生产者放弃的记录数
+    uint64_t dropped  = 0;  /// OVERWRITE_OLDEST下生产者丢弃的记录数
+    uint64_t padding  = 0;  /// 消费者跳过的填充记录数
+    uint64_t claims   = 0;  /// 跨过缓冲区末尾的认领数
+    bool     ok       = true;
+};
+
+/**
+ * @brief 校验一段认领的记录, 记录不会跨过缓冲区末尾, 因此每段都由完整的记录组成
+ */
+void checkSpan(const LogSpan& span, uint64_t& nextSeq, bool exact, Result& result) {
+    const char* p   = span.data;
+    const char* end = span.data + span.size;
+    while (p < end) {
+        LogRecordHeader header;
+        memcpy(&header, p, sizeof(header));
+        if (header.size < sizeof(header) || p + LogRecordHeader::Align(header.size) > end) {
+            fmt::print("bad record size {} at offset {}\n", header.size, p - span.data);
+            result.ok = false;
+            return;
+        }
+        if (header.kind == LogRecordHeader::PADDING) {
+            ++result.padding;
+            p += LogRecordHeader::Align(header.size);
+            continue;
+        }
+
+        uint64_t seq;
+        memcpy(&seq, p + sizeof(header), sizeof(seq));
+        if (seq < nextSeq || (exact && seq != nextSeq) || header.size != RecordSize(seq)) {
+            fmt::print("unexpected record {} (size {}), expected {}\n", seq, header.size, nextSeq);
+            result.ok = false;
+            return;
+        }
+        for (uint32_t i = kFixedSize; i < header.size; ++i) {
+            if (p[i] != PayloadByte(seq, i)) {
+                fmt::print("record {} corrupted at byte {}\n", seq, i);
+                result.ok = false;
+                return;
+            }
+        }
+        nextSeq = seq + 1;
+        ++result.received;
+        p += LogRecordHeader::Align(header.size);
+    }
+}
+
+/**
+ * @brief 按policy跑一轮生产者/消费者, BLOCK策略下要求按序收到全部记录
+ */
+Result run(const BackpressurePolicy& policy) {
+    CircleBlockingBuffer ring(kCapacity);
+    std::atomic<bool>    done{false};
+    Result               result;
+
+    std::thread producer([&]() {
+        for (uint64_t seq = 0; seq < kRecords; ++seq) {
+            // 丢弃策略下不等待消费者, 每写一批前让出CPU, 让消费者也能读到一部分记录.
+            if (policy.mode != BackpressurePolicy::BLOCK && seq % 32 == 0) {
+                std::this_thread::yield();
+            }
+            uint32_t size = RecordSize(seq);
+            char*    buf  = ring.reserve(size, policy);
+            if (buf == nullptr) {
+                ++result.skipped;
+                continue;
+            }
+            LogRecordHeader header{size, LogRecordHeader::TEXT, 0};
+            memcpy(buf, &header, sizeof(header));
+            memcpy(buf + sizeof(header), &seq, sizeof(seq));
+            for (uint32_t i = kFixedSize; i < size; ++i) {
+                buf[i] = PayloadByte(seq, i);
+            }
+            ring.commit(size);
+        }
+        done.store(true, std::memory_order_release);
+    });
+
+    bool     exact   = policy.mode == BackpressurePolicy::BLOCK;
+    uint64_t nextSeq = 0;
+    for (uint64_t round = 0;; ++round) {
+        // 定期暂停, 保证丢弃策略下缓冲区会写满.
+        if (round % 256 == 255) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        bool     finished = done.load(std::memory_order_acquire);
+        uint32_t used     = ring.getUsedSize();
+        if (used == 0) {
+            if (finished) {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        // 认领的长度必须取自getUsedSize(), 认领的两段才只包含完整的记录.
+        LogSpan spans[2];
+        if (ring.claim(used, spans) == 0) {
+            continue;
+        }
+        if (spans[1].size != 0) {
+            ++result.claims;
+        }
+        // 出错后继续读空缓冲区, 不让BLOCK策略的生产者一直等待.
+        if (result.ok) {
+            checkSpan(spans[0], nextSeq, exact, result);
+        }
+        if (result.ok) {
+            checkSpan(spans[1], nextSeq, exact, result);
+        }
+        // 偶尔持有认领的记录一段时间, 让生产者的丢弃与认领交错.
+        if (round % 16 == 0) {
+            std::this_thread::yield();
+        }
+        ring.release();
+    }
+
+    producer.join();
+    result.dropped = ring.getDropped();
+    return result;
+}
+
+/**
+ * @brief 跑一轮并校验记录总数, 失败时打印原因
+ */
+bool check(const char* name, const BackpressurePolicy& policy) {
+    Result result = run(policy);
+    fmt::print("{}: received {}, skipped {}, dropped {}, padding {}, wrapped claims {}\n", name,
+               result.received, result.skipped, result.dropped, result.padding, result.claims);
+    if (!result.ok) {
+        return false;
+    }
+    if (result.received + result.skipped + result.dropped != kRecords) {
+        fmt::print("{}: {} records lost\n", name,
+                   kRecords - result.received - result.skipped - result.dropped);
+        return false;
+    }
+    if (result.padding == 0) {
+        fmt::print("{}: the ring never wrapped with a padding record\n", name);
+        return false;
+    }
+    if ((policy.mode == BackpressurePolicy::DROP_NEWEST && result.skipped == 0) ||
+        (policy.mode == BackpressurePolicy::OVERWRITE_OLDEST && result.dropped == 0)) {
+        fmt::print("{}: the ring never filled up\n", name);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+int main() {
+    bool ok = true;
+    ok &= check("BLOCK", BackpressurePolicy{BackpressurePolicy::BLOCK, xhong::LogLevel::WARN});
+    ok &= check("DROP_NEWEST",
+                BackpressurePolicy{BackpressurePolicy::DROP_NEWEST, xhong::LogLevel::WARN});
+    ok &= check("OVERWRITE_OLDEST",
+                BackpressurePolicy{BackpressurePolicy::OVERWRITE_OLDEST, xhong::LogLevel::WARN});
+    return ok ? 0 : 1;
+}